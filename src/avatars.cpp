@@ -327,18 +327,18 @@ private:
 VCardStaticAvatar::VCardStaticAvatar(AvatarFactory* factory, const Jid& j)
 	: Avatar(factory), jid_(j.bare())
 { 
-	const VCard* vcard = VCardFactory::instance()->vcard(jid_);
-	if (vcard && !vcard->photo().isEmpty())
-		setImage(vcard->photo());
+	QByteArray photo = VCardFactory::instance()->photo(jid_);
+	if (!photo.isEmpty())
+		setImage(photo);
 	connect(VCardFactory::instance(),SIGNAL(vcardChanged(const Jid&)),SLOT(vcardChanged(const Jid&)));
 }
 
 void VCardStaticAvatar::vcardChanged(const Jid& j)
 {
 	if (j.compare(jid_,false)) {
-		const VCard* vcard = VCardFactory::instance()->vcard(jid_);
-		if (vcard && !vcard->photo().isEmpty())
-			setImage(vcard->photo());
+		QByteArray photo = VCardFactory::instance()->photo(jid_);
+		if (!photo.isEmpty())
+			setImage(photo);
 		else
 			resetImage();
 		emit avatarChanged(jid_);
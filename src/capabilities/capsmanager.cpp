@@ -117,6 +117,10 @@ void CapsManager::updateCaps(const Jid& jid, const QString& node, const QString&
 			
 			emit capsChanged(jid); 
 
+			foreach(CapsSpec s, caps) {
+				registry_->updateLastSeen(s);
+			}
+
 			// Register new caps and check if we need to discover features
 			if (isEnabled()) {
 				foreach(CapsSpec s, caps) {
@@ -234,15 +238,20 @@ bool CapsManager::capsEnabled(const Jid& jid) const
 XMPP::Features CapsManager::features(const Jid& jid) const
 {
 	//qDebug() << "caps.cpp: Retrieving features of " << jid.full();
-	QStringList f;
-	if (capsEnabled(jid)) {
-		CapsSpecs cs = capsSpecs_[jid.full()].flatten();
-		foreach(CapsSpec s, cs) {
-			//qDebug() << QString("    %1").arg(registry_->features(s).list().join("\n"));
-			f += registry_->features(s).list();
-		}
-	}
-	return Features(f);
+	QMap<QString,CapsSpec>::ConstIterator i = capsSpecs_.find(jid.full());
+	if (i != capsSpecs_.end())
+		return registry_->flattenedFeatures(i.value());
+	return Features();
+}
+
+/**
+ * \brief Checks whether a given JID supports \a feature.
+ * This is cheaper than searching the list returned by features().
+ */
+bool CapsManager::hasFeature(const Jid& jid, const QString& feature) const
+{
+	QMap<QString,CapsSpec>::ConstIterator i = capsSpecs_.find(jid.full());
+	return i != capsSpecs_.end() && registry_->hasFeature(i.value(), feature);
 }
 	
 /**
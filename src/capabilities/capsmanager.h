@@ -52,6 +52,7 @@ public:
 	void disableCaps(const Jid& jid);
 	bool capsEnabled(const Jid& jid) const;
 	XMPP::Features features(const Jid& jid) const;
+	bool hasFeature(const Jid& jid, const QString& feature) const;
 	QString clientName(const Jid& jid) const;
 	QString clientVersion(const Jid& jid) const;
 	
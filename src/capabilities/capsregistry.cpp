@@ -23,6 +23,7 @@
 #include <QTextCodec>
 #include <QFile>
 #include <QDomElement>
+#include <QTextStream>
 
 #include "xmpp_features.h"
 #include "capsregistry.h"
@@ -30,6 +31,15 @@
 
 using namespace XMPP;
 
+// delay before newly registered capabilities are written to disk
+#define CAPS_JOURNAL_DELAY 5000
+
+// number of journal entries after which the whole file is rewritten
+#define CAPS_JOURNAL_COMPACT 100
+
+// capabilities that weren't seen for this number of days are dropped
+#define CAPS_MAX_AGE 90
+
 // -----------------------------------------------------------------------------
 
 CapsRegistry::CapsInfo::CapsInfo()
@@ -57,6 +67,11 @@ void CapsRegistry::CapsInfo::setFeatures(const XMPP::Features& f)
 	features_ = f;
 }
 	
+const QDateTime& CapsRegistry::CapsInfo::lastSeen() const
+{
+	return lastSeen_;
+}
+
 void CapsRegistry::CapsInfo::updateLastSeen()
 {
 	lastSeen_ = QDateTime::currentDateTime();
@@ -134,7 +149,177 @@ void CapsRegistry::CapsInfo::fromXml(const QDomElement& e)
  * \brief Default constructor.
  */
 CapsRegistry::CapsRegistry() 
+	: journalSize_(0)
+{
+	journalTimer_.setSingleShot(true);
+	journalTimer_.setInterval(CAPS_JOURNAL_DELAY);
+	connect(&journalTimer_, SIGNAL(timeout()), SLOT(writeJournal()));
+}
+
+/**
+ * \brief Loads the capabilities info from \a fileName, and keeps the file
+ * up to date from now on.
+ *
+ * Newly registered capabilities are appended to a journal next to the
+ * file a few seconds after they arrive. The file itself is only rewritten
+ * by compact(), which also drops the capabilities that weren't seen for a
+ * long time.
+ */
+void CapsRegistry::setFileName(const QString& fileName)
+{
+	fileName_ = fileName;
+
+	// a compact() that was interrupted left the previous file behind
+	if (!QFile::exists(fileName_) && QFile::exists(fileName_ + ".old"))
+		QFile::rename(fileName_ + ".old", fileName_);
+
+	QFile file(fileName_);
+	if (file.exists())
+		load(file);
+
+	bool journal = loadJournal();
+	if (prune() > 0 || journal)
+		compact();
+}
+
+/**
+ * \brief Rewrites the file set with setFileName(), and empties the journal.
+ */
+void CapsRegistry::compact()
+{
+	journalTimer_.stop();
+	pending_.clear();
+	if (fileName_.isEmpty())
+		return;
+
+	prune();
+
+	QFile file(fileName_ + ".new");
+	save(file);
+	if (file.error() != QFile::NoError || file.size() == 0) {
+		qWarning() << "Caps: Unable to write" << file.fileName();
+		return;
+	}
+
+	// swap the files, keeping the old one until the new one is in place,
+	// and only drop the journal once its contents are in the new file
+	QString oldName = fileName_ + ".old";
+	QFile::remove(oldName);
+	if (QFile::exists(fileName_) && !QFile::rename(fileName_, oldName)) {
+		qWarning() << "Caps: Unable to replace" << fileName_;
+		file.remove();
+		return;
+	}
+	if (!file.rename(fileName_)) {
+		qWarning() << "Caps: Unable to replace" << fileName_;
+		QFile::rename(oldName, fileName_);
+		file.remove();
+		return;
+	}
+	QFile::remove(oldName);
+	QFile::remove(fileName_ + ".journal");
+	journalSize_ = 0;
+}
+
+/**
+ * \brief Appends the capabilities registered since the last call to the
+ * journal.
+ */
+void CapsRegistry::writeJournal()
 {
+	if (fileName_.isEmpty() || pending_.isEmpty())
+		return;
+
+	if (journalSize_ + pending_.count() > CAPS_JOURNAL_COMPACT) {
+		compact();
+		return;
+	}
+
+	QFile file(fileName_ + ".journal");
+	if (!file.open(QIODevice::WriteOnly | QIODevice::Append)) {
+		qWarning() << "Caps: Unable to open" << file.fileName();
+		return;
+	}
+
+	QDomDocument doc;
+	QTextStream t(&file);
+	t.setCodec(QTextCodec::codecForName("UTF-8"));
+	foreach(CapsSpec spec, pending_) {
+		if (capsInfo_.contains(spec))
+			infoElement(&doc, spec, capsInfo_[spec]).save(t, 0);
+	}
+
+	journalSize_ += pending_.count();
+	pending_.clear();
+}
+
+/**
+ * \brief Reads the entries appended by writeJournal().
+ * Returns \c true if there was a journal.
+ */
+bool CapsRegistry::loadJournal()
+{
+	QFile file(fileName_ + ".journal");
+	if (!file.open(QIODevice::ReadOnly))
+		return false;
+
+	QByteArray data = file.readAll();
+	QDomDocument doc;
+	if (!doc.setContent("<capabilities>" + data + "</capabilities>")) {
+		// an entry might have been written only partially
+		data.truncate(qMax(data.lastIndexOf("</info>") + 7, 0));
+		if (!doc.setContent("<capabilities>" + data + "</capabilities>")) {
+			qWarning() << "CapsRegistry: Cannot parse journal";
+			return true;
+		}
+	}
+
+	for (QDomElement e = doc.documentElement().firstChildElement("info"); !e.isNull(); e = e.nextSiblingElement("info"))
+		loadInfo(e);
+	return true;
+}
+
+/**
+ * \brief Drops all capabilities that weren't seen for CAPS_MAX_AGE days.
+ */
+int CapsRegistry::prune()
+{
+	QDateTime limit = QDateTime::currentDateTime().addDays(-CAPS_MAX_AGE);
+
+	int count = 0;
+	QMap<CapsSpec,CapsInfo>::Iterator i = capsInfo_.begin();
+	while (i != capsInfo_.end()) {
+		if (i.value().lastSeen() < limit) {
+			i = capsInfo_.erase(i);
+			count++;
+		}
+		else {
+			++i;
+		}
+	}
+
+	if (count > 0)
+		featureSets_.clear();
+	return count;
+}
+
+QDomElement CapsRegistry::infoElement(QDomDocument* doc, const CapsSpec& spec, const CapsInfo& info) const
+{
+	QDomElement e = info.toXml(doc);
+	e.setAttribute("node",spec.node());
+	e.setAttribute("ver",spec.version());
+	e.setAttribute("ext",spec.extensions());
+	return e;
+}
+
+void CapsRegistry::loadInfo(const QDomElement& i)
+{
+	CapsInfo info;
+	info.fromXml(i);
+	CapsSpec spec(i.attribute("node"),i.attribute("ver"),i.attribute("ext"));
+	capsInfo_[spec] = info;
+	featureSets_.clear();
+	//qDebug() << QString("Read %1 %2 %3").arg(spec.node()).arg(spec.version()).arg(spec.extensions());
 }
 
 /**
@@ -148,11 +333,7 @@ void CapsRegistry::save(QIODevice& out)
 	doc.appendChild(capabilities);
 	QMap<CapsSpec,CapsInfo>::ConstIterator i = capsInfo_.begin();
 	for( ; i != capsInfo_.end(); i++) {
-		QDomElement info = i.value().toXml(&doc);
-		info.setAttribute("node",i.key().node());
-		info.setAttribute("ver",i.key().version());
-		info.setAttribute("ext",i.key().extensions());
-		capabilities.appendChild(info);
+		capabilities.appendChild(infoElement(&doc, i.key(), i.value()));
 	}
 
 	IODeviceOpener opener(&out, QIODevice::WriteOnly);
@@ -197,11 +378,7 @@ void CapsRegistry::load(QIODevice& in)
 		}
 
 		if(i.tagName() == "info") {
-			CapsInfo info;
-			info.fromXml(i);
-			CapsSpec spec(i.attribute("node"),i.attribute("ver"),i.attribute("ext"));
-			capsInfo_[spec] = info;
-			//qDebug() << QString("Read %1 %2 %3").arg(spec.node()).arg(spec.version()).arg(spec.extensions());
+			loadInfo(i);
 		}
 		else {
 			qWarning("capsregistry.cpp: Unknown element");
@@ -219,10 +396,27 @@ void CapsRegistry::registerCaps(const CapsSpec& spec,const XMPP::DiscoItem::Iden
 		info.setIdentities(identities);
 		info.setFeatures(features);
 		capsInfo_[spec] = info;
+		featureSets_.clear();
+
+		if (!fileName_.isEmpty()) {
+			pending_ += spec;
+			if (!journalTimer_.isActive())
+				journalTimer_.start();
+		}
+
 		emit registered(spec);
 	}
 }
 
+/**
+ * \brief Marks the capabilities as being in use, so that they aren't pruned.
+ */
+void CapsRegistry::updateLastSeen(const CapsSpec& spec)
+{
+	if (capsInfo_.contains(spec))
+		capsInfo_[spec].updateLastSeen();
+}
+
 /**
  * \brief Checks if capabilities have been registered.
  */
@@ -247,3 +441,43 @@ XMPP::DiscoItem::Identities CapsRegistry::identities(const CapsSpec& spec) const
 {
 	return capsInfo_[spec].identities();
 }
+
+/**
+ * \brief Returns the combined features of the base caps and all extensions
+ * of \a spec.
+ *
+ * The result is computed once for every distinct spec, and is shared until
+ * new capabilities are registered.
+ */
+const XMPP::Features& CapsRegistry::flattenedFeatures(const CapsSpec& spec) const
+{
+	return featureSet(spec).features;
+}
+
+/**
+ * \brief Checks whether the base caps or one of the extensions of \a spec
+ * provide \a feature.
+ */
+bool CapsRegistry::hasFeature(const CapsSpec& spec, const QString& feature) const
+{
+	return featureSet(spec).set.contains(feature);
+}
+
+const CapsRegistry::FeatureSet& CapsRegistry::featureSet(const CapsSpec& spec) const
+{
+	QMap<CapsSpec,FeatureSet>::ConstIterator it = featureSets_.find(spec);
+	if (it != featureSets_.end())
+		return it.value();
+
+	QStringList f;
+	foreach(CapsSpec s, spec.flatten()) {
+		QMap<CapsSpec,CapsInfo>::ConstIterator i = capsInfo_.find(s);
+		if (i != capsInfo_.end())
+			f += i.value().features().list();
+	}
+
+	FeatureSet set;
+	set.features = Features(f);
+	set.set = f.toSet();
+	return featureSets_.insert(spec, set).value();
+}
@@ -27,6 +27,8 @@
 #include <QMap>
 #include <QDateTime>
 #include <QPair>
+#include <QSet>
+#include <QTimer>
 
 #include "xmpp_features.h"
 #include "xmpp_discoitem.h"
@@ -43,11 +45,18 @@ class CapsRegistry : public QObject
 public:
 	CapsRegistry();
 
+	void setFileName(const QString&);
+	void compact();
+
 	void registerCaps(const CapsSpec&, const XMPP::DiscoItem::Identities&, const XMPP::Features& features);
+	void updateLastSeen(const CapsSpec&);
 	bool isRegistered(const CapsSpec&) const;
 	XMPP::Features features(const CapsSpec&) const;
 	XMPP::DiscoItem::Identities identities(const CapsSpec&) const;
 
+	const XMPP::Features& flattenedFeatures(const CapsSpec&) const;
+	bool hasFeature(const CapsSpec&, const QString& feature) const;
+
 signals:
 	void registered(const CapsSpec&);
 
@@ -55,6 +64,9 @@ public slots:
 	void load(QIODevice& target);
 	void save(QIODevice& target);
 
+private slots:
+	void writeJournal();
+
 private:
 	class CapsInfo
 	{
@@ -69,7 +81,7 @@ private:
 			QDomElement toXml(QDomDocument *) const;
 			void fromXml(const QDomElement&);
 
-		protected:
+			const QDateTime& lastSeen() const;
 			void updateLastSeen();
 			
 		private:
@@ -78,6 +90,26 @@ private:
 			QDateTime lastSeen_;
 	};
 	QMap<CapsSpec,CapsInfo> capsInfo_;
+
+	// features of a client including all its extensions, shared by all
+	// jids with the same caps
+	struct FeatureSet
+	{
+		XMPP::Features features;
+		QSet<QString> set;
+	};
+	mutable QMap<CapsSpec,FeatureSet> featureSets_;
+	const FeatureSet& featureSet(const CapsSpec&) const;
+
+	QString fileName_;
+	QList<CapsSpec> pending_;
+	QTimer journalTimer_;
+	int journalSize_;
+
+	QDomElement infoElement(QDomDocument*, const CapsSpec&, const CapsInfo&) const;
+	void loadInfo(const QDomElement&);
+	bool loadJournal();
+	int prune();
 };
 
 
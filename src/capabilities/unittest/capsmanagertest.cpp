@@ -62,6 +62,7 @@ class CapsManagerTest : public CppUnit::TestFixture
 	CPPUNIT_TEST_SUITE(CapsManagerTest);
 
 	CPPUNIT_TEST(testUpdateCaps);
+	CPPUNIT_TEST(testHasFeature);
 
 	CPPUNIT_TEST(testCapsEnabled);
 	CPPUNIT_TEST(testCapsEnabled_NoCaps);
@@ -80,6 +81,7 @@ public:
 	CapsManager* createManager(const QString& jid);
 
 	void testUpdateCaps();
+	void testHasFeature();
 	void testCapsEnabled();
 	void testCapsEnabled_NoCaps();
 	void testDisableCaps();
@@ -150,6 +152,24 @@ void CapsManagerTest::testUpdateCaps()
 	CPPUNIT_ASSERT(features.test(QStringList("c2_f2")));
 }
 
+void CapsManagerTest::testHasFeature()
+{
+	QStringList capabilities;
+	capabilities << "c1" << "c2" << "c3";
+	addContact("you@example.com/a", "myclient", "myversion", capabilities);
+	addContact("you@example.com/b", "myclient", "myversion", capabilities);
+	CapsManager* manager = createManager("me@example.com");
+
+	manager->updateCaps("you@example.com/a", "myclient", "myversion", "c1");
+	manager->updateCaps("you@example.com/b", "myclient", "myversion", "c1 c2");
+
+	CPPUNIT_ASSERT(manager->hasFeature("you@example.com/a", "myversion_f1"));
+	CPPUNIT_ASSERT(manager->hasFeature("you@example.com/a", "c1_f2"));
+	CPPUNIT_ASSERT(!manager->hasFeature("you@example.com/a", "c2_f1"));
+	CPPUNIT_ASSERT(manager->hasFeature("you@example.com/b", "c2_f1"));
+	CPPUNIT_ASSERT(!manager->hasFeature("you@example.com/c", "myversion_f1"));
+}
+
 void CapsManagerTest::testCapsEnabled()
 {
 	QStringList capabilities;
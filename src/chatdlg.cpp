@@ -504,6 +504,8 @@ void ChatDlg::setLooks()
 	chatView()->setFont(f);
 	chatEdit()->setFont(f);
 
+	chatView()->setScrollbackLimit(PsiOptions::instance()->getOption("options.ui.chat.scrollback-limit").toInt());
+
 	// update contact info
 	status_ = -2; // sick way of making it redraw the status
 	updateContact(jid(), false);
@@ -1038,6 +1040,8 @@ bool ChatDlg::isEmoteMessage(const XMPP::Message& m)
 QString ChatDlg::messageText(const XMPP::Message& m)
 {
 	bool emote = isEmoteMessage(m);
+	bool emoticons = PsiOptions::instance()->getOption("options.ui.emoticons.use-emoticons").toBool();
+	bool legacy = PsiOptions::instance()->getOption("options.ui.chat.legacy-formatting").toBool();
 	QString txt;
 
 	if (m.containsHTML() && PsiOptions::instance()->getOption("options.html.chat.render").toBool() && !m.html().text().isEmpty()) {
@@ -1048,6 +1052,11 @@ QString ChatDlg::messageText(const XMPP::Message& m)
 			txt = txt.remove(cmd, me_cmd.length());
 		}
 		// qWarning("html body:\n%s\n",qPrintable(txt));
+
+		if (emoticons)
+			txt = TextUtil::emoticonify(txt);
+		if (legacy)
+			txt = TextUtil::legacyFormat(txt);
 	}
 	else {
 		txt = m.body();
@@ -1055,16 +1064,10 @@ QString ChatDlg::messageText(const XMPP::Message& m)
 		if (emote)
 			txt = txt.mid(me_cmd.length());
 
-		txt = TextUtil::plain2rich(txt);
-		txt = TextUtil::linkify(txt);
+		txt = TextUtil::formatMessage(txt, emoticons, legacy);
 		// qWarning("regular body:\n%s\n",qPrintable(txt));
 	}
 
-	if (PsiOptions::instance()->getOption("options.ui.emoticons.use-emoticons").toBool())
-		txt = TextUtil::emoticonify(txt);
-	if (PsiOptions::instance()->getOption("options.ui.chat.legacy-formatting").toBool())
-		txt = TextUtil::legacyFormat(txt);
-
 	return txt;
 }
 
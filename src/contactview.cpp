@@ -35,6 +35,8 @@
 #include <QKeyEvent>
 #include <QEvent>
 #include <QList>
+#include <QHash>
+#include <QSet>
 #include <QDropEvent>
 #include <QPixmap>
 #include <QDesktopWidget>
@@ -60,6 +62,7 @@
 #include "textutil.h"
 #include "bookmarkmanagedlg.h"
 #include "bookmarkmanager.h"
+#include "contactlistsearch.h"
 
 static inline int rankStatus(int status) 
 {
@@ -115,6 +118,20 @@ public:
 	UserListItem su;
 	Q3PtrList<Entry> roster;
 	Q3PtrList<ContactViewItem> groups;
+
+	// lookup tables for the roster
+	QHash<QString, Entry*> entryByJid;
+	QHash<ContactViewItem*, Entry*> entryByItem;
+
+	// counters kept up to date as entries come and go, so that the group
+	// information doesn't have to be recounted from scratch
+	int totalOnline;
+	QHash<QString, int> groupRefs;   // entries per roster group
+	QHash<QString, int> groupTotal;  // non-transport entries per roster group, "" is General
+	QHash<ContactViewItem*, int> groupItems;   // contact items per group item
+	QHash<ContactViewItem*, int> groupOnline;  // available contact items per group item
+	QSet<ContactViewItem*> onlineItems;
+
 	int oldstate;
 	QTimer *t;
 	PsiAccount *pa;
@@ -145,6 +162,7 @@ ContactProfile::ContactProfile(PsiAccount *pa, const QString &name, ContactView
 	connect(pa->psi(), SIGNAL(accountCountChanged()), d, SLOT(numAccountsChanged()));
 
 	d->roster.setAutoDelete(true);
+	d->totalOnline = 0;
 
 	d->self = 0;
 
@@ -354,6 +372,8 @@ void ContactProfile::checkDestroyGroup(ContactViewItem *group)
 {
 	if(group->childCount() == 0) {
 		d->groups.remove(group);
+		d->groupItems.remove(group);
+		d->groupOnline.remove(group);
 		delete group;
 	}
 }
@@ -383,15 +403,20 @@ void ContactProfile::updateEntry(const UserListItem &u)
 			e = new Entry;
 			d->roster.append(e);
 			e->u = u;
+			d->entryByJid.insert(e->u.jid().full(), e);
+			countEntry(e, 1);
 		}
 		else {
+			countEntry(e, -1);
 			e->u = u;
+			countEntry(e, 1);
 			removeUnneededContactItems(e);
 
 			// update remaining items
 			Q3PtrListIterator<ContactViewItem> it(e->cvi);
 			for(ContactViewItem *i; (i = it.current()); ++it) {
 				i->setContact(&e->u);
+				updateItemOnline(i, u.isAvailable());
 				if(!u.isAvailable())
 					i->stopAnimateNick();
 			}
@@ -432,6 +457,9 @@ ContactViewItem *ContactProfile::addContactItem(Entry *e, ContactViewItem *group
 {
 	ContactViewItem *i = new ContactViewItem(&e->u, this, group_item);
 	e->cvi.append(i);
+	d->entryByItem.insert(i, e);
+	d->groupItems[group_item]++;
+	updateItemOnline(i, e->u.isAvailable());
 	if(e->alerting)
 		i->setAlert(&e->anim);
 	deferredUpdateGroups();
@@ -470,6 +498,9 @@ void ContactProfile::removeContactItem(Entry *e, ContactViewItem *i)
 
 	ContactViewItem *group_item = (ContactViewItem *)static_cast<Q3ListViewItem *>(i)->parent();
 	//printf("ContactProfile: removing [%s] from group [%s]\n", e->u.jid().full().latin1(), group_item->groupName().latin1());
+	updateItemOnline(i, false);
+	d->groupItems[group_item]--;
+	d->entryByItem.remove(i);
 	e->cvi.removeRef(i);
 	deferredUpdateGroups();
 	checkDestroyGroup(group_item);
@@ -623,9 +654,63 @@ void ContactProfile::removeEntry(Entry *e)
 {
 	e->alerting = false;
 	clearContactItems(e);
+	countEntry(e, -1);
+	d->entryByJid.remove(e->u.jid().full());
 	d->roster.remove(e);
 }
 
+/**
+ * Adds (\a delta = 1) or removes (\a delta = -1) the contribution of \a e
+ * to the per-group and online counters.
+ */
+void ContactProfile::countEntry(Entry *e, int delta)
+{
+	const UserListItem &u = e->u;
+	if(u.isAvailable())
+		d->totalOnline += delta;
+
+	const QStringList &groups = u.groups();
+	foreach(QString group, groups) {
+		if((d->groupRefs[group] += delta) <= 0)
+			d->groupRefs.remove(group);
+	}
+
+	if(u.isTransport())
+		return;
+	if(groups.isEmpty()) {
+		d->groupTotal[""] += delta;
+	}
+	else {
+		// a group might be listed twice, but the contact is counted once
+		QSet<QString> unique;
+		foreach(QString group, groups) {
+			if(!unique.contains(group)) {
+				unique += group;
+				d->groupTotal[group] += delta;
+			}
+		}
+	}
+}
+
+/**
+ * Updates the online counter of the group of \a i.
+ */
+void ContactProfile::updateItemOnline(ContactViewItem *i, bool online)
+{
+	if(online == d->onlineItems.contains(i))
+		return;
+
+	ContactViewItem *group_item = (ContactViewItem *)static_cast<Q3ListViewItem *>(i)->parent();
+	if(online) {
+		d->onlineItems += i;
+		d->groupOnline[group_item]++;
+	}
+	else {
+		d->onlineItems.remove(i);
+		d->groupOnline[group_item]--;
+	}
+}
+
 void ContactProfile::setAlert(const Jid &j, const PsiIcon *anim)
 {
 	if(d->su.jid().compare(j)) {
@@ -677,25 +762,12 @@ void ContactProfile::clear()
 
 ContactProfile::Entry *ContactProfile::findEntry(const Jid &jid) const
 {
-	Q3PtrListIterator<Entry> it(d->roster);
-	for(Entry *e; (e = it.current()); ++it) {
-		if(e->u.jid().compare(jid))
-			return e;
-	}
-	return 0;
+	return d->entryByJid.value(jid.full());
 }
 
 ContactProfile::Entry *ContactProfile::findEntry(ContactViewItem *i) const
 {
-	Q3PtrListIterator<Entry> it(d->roster);
-	for(Entry *e; (e = it.current()); ++it) {
-		Q3PtrListIterator<ContactViewItem> ci(e->cvi);
-		for(ContactViewItem *cvi; (cvi = ci.current()); ++ci) {
-			if(cvi == i)
-				return e;
-		}
-	}
-	return 0;
+	return d->entryByItem.value(i);
 }
 
 // return a list of contacts from a CVI group
@@ -716,29 +788,13 @@ QList<XMPP::Jid> ContactProfile::contactListFromCVGroup(ContactViewItem *group)
 // return the number of contacts from a CVI group
 int ContactProfile::contactSizeFromCVGroup(ContactViewItem *group) const
 {
-	int total = 0;
-
-	for(ContactViewItem *item = (ContactViewItem *)group->firstChild(); item ; item = (ContactViewItem *)item->nextSibling()) {
-		if(item->type() != ContactViewItem::Contact)
-			continue;
-
-		++total;
-	}
-
-	return total;
+	return d->groupItems.value(group);
 }
 
-// return the number of contacts from a CVI group
+// return the number of available contacts from a CVI group
 int ContactProfile::contactsOnlineFromCVGroup(ContactViewItem *group) const
 {
-	int total = 0;
-
-	for(ContactViewItem *item = (ContactViewItem *)group->firstChild(); item ; item = (ContactViewItem *)item->nextSibling()) {
-		if(item->type() == ContactViewItem::Contact && item->u()->isAvailable())
-			++total;
-	}
-
-	return total;
+	return d->groupOnline.value(group);
 }
 
 // return a list of contacts associated with "groupName"
@@ -772,29 +828,7 @@ QList<XMPP::Jid> ContactProfile::contactListFromGroup(const QString &groupName)
 // return the number of contacts associated with "groupName"
 int ContactProfile::contactSizeFromGroup(const QString &groupName) const
 {
-	int total = 0;
-
-	Q3PtrListIterator<Entry> it(d->roster);
-	for(Entry *e; (e = it.current()); ++it) {
-		const UserListItem &u = e->u;
-		if(u.isTransport())
-			continue;
-		const QStringList &g = u.groups();
-		if(g.isEmpty()) {
-			if(groupName.isEmpty())
-				++total;
-		}
-		else {
-			for(QStringList::ConstIterator git = g.begin(); git != g.end(); ++git) {
-				if(*git == groupName) {
-					++total;
-					break;
-				}
-			}
-		}
-	}
-
-	return total;
+	return d->groupTotal.value(groupName);
 }
 
 void ContactProfile::updateGroupInfo(ContactViewItem *group)
@@ -825,16 +859,7 @@ void ContactProfile::updateGroupInfo(ContactViewItem *group)
 
 QStringList ContactProfile::groupList() const
 {
-	QStringList groupList;
-
-	Q3PtrListIterator<Entry> it(d->roster);
-	for(Entry *e; (e = it.current()); ++it) {
-		foreach(QString group, e->u.groups()) {
-			if (!groupList.contains(group))
-				groupList.append(group);
-		}
-	}
-
+	QStringList groupList = d->groupRefs.keys();
 	groupList.sort();
 	return groupList;
 }
@@ -861,15 +886,9 @@ void ContactProfile::deferredUpdateGroups()
 
 void ContactProfile::updateGroups()
 {
-	int totalOnline = 0;
 	{
-		Q3PtrListIterator<Entry> it(d->roster);
-		for(Entry *e; (e = it.current()); ++it) {
-			if(e->u.isAvailable())
-				++totalOnline;
-		}
 		if(d->cvi && PsiOptions::instance()->getOption("options.ui.contactlist.show-group-counts").toBool())
-			d->cvi->setGroupInfo(QString("(%1/%2)").arg(totalOnline).arg(d->roster.count()));
+			d->cvi->setGroupInfo(QString("(%1/%2)").arg(d->totalOnline).arg(d->roster.count()));
 	}
 
 	{
@@ -2080,17 +2099,11 @@ bool ContactView::filterContact(ContactViewItem *item, bool refineSearch)
 	if (refineSearch && !item->isVisible()) {
 		return false;		
 	}
-	if (TextUtil::rich2plain(item->text(0)).contains(filterString_,Qt::CaseInsensitive))
-	{
+	bool wasVisible = item->isVisible();
+	setFilterVisible(item, item->filterKey().contains(filterString_));
+	if (item->isVisible() && !wasVisible) {
 		ensureItemVisible(item);
-		item->setVisible(true);
-		item->optionsUpdate();			
-	}
-	else
-	{
-		item->setVisible(false);
 	}
-	item->repaint();	
 	return item->isVisible();
 }
 
@@ -2107,10 +2120,8 @@ bool ContactView::filterGroup(ContactViewItem *group, bool refineSearch)
 	if (refineSearch && !group->isVisible()) {
 		return false;	
 	}
-	group->setVisible(true); //if not refined search
 	
 	//iterate over children
-	Q3ListViewItemIterator it(group);
 	bool groupContainsAFinding = false;
 	ContactViewItem *item = static_cast<ContactViewItem*>(group->firstChild());
 	while(item) {
@@ -2118,40 +2129,100 @@ bool ContactView::filterGroup(ContactViewItem *group, bool refineSearch)
 			groupContainsAFinding = true;
         item = static_cast<ContactViewItem*>(item->nextSibling());
 	}
-	if (groupContainsAFinding == false) {
-		group->setVisible(false);		
-	}
-	group->repaint();
+	setFilterVisible(group, groupContainsAFinding);
 	return groupContainsAFinding;
 }
 
+/**
+ * Returns \a text in the form that is matched against ContactViewItem::filterKey().
+ */
+QString ContactView::filterKey(const QString &text) const
+{
+	return TextUtil::rich2plain(text).toLower();
+}
+
+void ContactView::setFilterVisible(ContactViewItem *item, bool visible)
+{
+	if (item->isVisible() == visible)
+		return;
+
+	item->setVisible(visible);
+	if (visible)
+		item->optionsUpdate();
+}
+
 void ContactView::setFilter(QString const &text)
 {
-	bool refineSearch = text.startsWith(filterString_);
-	filterString_ = text;
-	
+	QString filter = text.toLower();
+	ContactListSearch::Change change = ContactListSearch::Replaced;
+	if (!filterString_.isNull())
+		change = ContactListSearch::change(filterString_, filter);
+	filterString_ = filter;
+	if (change == ContactListSearch::Unchanged)
+		return;
+
+	// Decide on all items first and show the result with a single update
+	bool updates = viewport()->isUpdatesEnabled();
+	viewport()->setUpdatesEnabled(false);
+
+	ContactViewItem *firstFinding = 0;
 	Q3ListViewItemIterator it(d->cv);
-	for (ContactViewItem *item; (item = (ContactViewItem *)it.current()); ++it)
-	{	
-		if (item->type() == ContactViewItem::Group) {
-			filterGroup(item, refineSearch);
+	for (ContactViewItem *group; (group = (ContactViewItem *)it.current()); ++it) {
+		if (group->type() != ContactViewItem::Group) {
+			continue;
+		}
+		// a narrowed filter can't reveal anything in a hidden group
+		if (change == ContactListSearch::Narrowed && !group->isVisible()) {
+			continue;
+		}
+
+		bool groupContainsAFinding = false;
+		ContactViewItem *item = static_cast<ContactViewItem*>(group->firstChild());
+		for (; item; item = static_cast<ContactViewItem*>(item->nextSibling())) {
+			if (item->type() != ContactViewItem::Contact) {
+				continue;
+			}
+			// a narrowed filter can only hide visible items and a widened one only show hidden items
+			bool visible = item->isVisible();
+			if (change == ContactListSearch::Replaced
+				|| (change == ContactListSearch::Narrowed && visible)
+				|| (change == ContactListSearch::Widened && !visible)) {
+				visible = item->filterKey().contains(filterString_);
+				setFilterVisible(item, visible);
+			}
+			if (visible) {
+				groupContainsAFinding = true;
+				if (!firstFinding)
+					firstFinding = item;
+			}
 		}
+		setFilterVisible(group, groupContainsAFinding);
 	}
+
+	viewport()->setUpdatesEnabled(updates);
+	if (firstFinding)
+		ensureItemVisible(firstFinding);
+	viewport()->update();
 }
 
 void ContactView::clearFilter()
 {
 	filterString_=QString();
+
+	bool updates = viewport()->isUpdatesEnabled();
+	viewport()->setUpdatesEnabled(false);
+
 	Q3ListViewItemIterator it(d->cv);
 	for (ContactViewItem *item; (item = (ContactViewItem *)it.current()); ++it) 
 	{
 		if (item->type() != ContactViewItem::Contact && item->type() != ContactViewItem::Group) {
 			continue;
 		}
-		item->setVisible(true);
-		item->optionsUpdate();
-		item->repaint();
+		setFilterVisible(item, true);
 	}	
+
+	viewport()->setUpdatesEnabled(updates);
+	viewport()->update();
 }
 
 
@@ -2932,6 +3003,7 @@ public:
 
 	// contact
 	UserListItem *u;
+	QString filterKey; // text(0) as returned by ContactView::filterKey()
 	bool isAgent;
 	bool alerting;
 	bool animatingNick;
@@ -3431,6 +3503,20 @@ void ContactViewItem::resetName(bool forceNoStatusMsg)
 	}
 }
 
+void ContactViewItem::setText(int column, const QString &text)
+{
+	// Keep the key for ContactView::setFilter() in sync with the shown text
+	if (column == 0 && type_ == Contact && text != this->text(0))
+		d->filterKey = static_cast<ContactView*>(Q3ListViewItem::listView())->filterKey(text);
+
+	RichListViewItem::setText(column, text);
+}
+
+const QString & ContactViewItem::filterKey() const
+{
+	return d->filterKey;
+}
+
 void ContactViewItem::resetGroupName()
 {
 	if ( d->groupName != text(0) )
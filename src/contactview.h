@@ -150,6 +150,8 @@ private:
 	void clearContactItems(Entry *e);
 
 	void removeEntry(Entry *);
+	void countEntry(Entry *, int delta);
+	void updateItemOnline(ContactViewItem *, bool online);
 	Entry *findEntry(const Jid &) const;
 	Entry *findEntry(ContactViewItem *) const;
 
@@ -284,7 +286,10 @@ private:
 	QPoint lcto_pos;
 	Q3ListViewItem *lcto_item;
 	QSize lastSize;
-	QString filterString_;
+	QString filterString_; // lower case, like the keys from filterKey()
+
+	QString filterKey(const QString &text) const;
+	void setFilterVisible(ContactViewItem *item, bool visible);
 
 	friend class ContactProfile;
 	void link(ContactProfile *);
@@ -376,8 +381,11 @@ public:
 	void updatePosition();
 	void optionsUpdate();
 
+	const QString & filterKey() const;
+
 	// reimplemented functions
 	int rtti() const;
+	void setText(int column, const QString &text);
 	void paintFocus(QPainter *, const QColorGroup &, const QRect &);
 	void paintBranches(QPainter *, const QColorGroup &, int, int, int);
 	void paintCell(QPainter *, const QColorGroup & cg, int column, int width, int alignment);
@@ -0,0 +1,216 @@
+/*
+ * emoticonmatcher.cpp - finds emoticons in plain text
+ * Copyright (C) 2008  Psi Development Team
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include "emoticonmatcher.h"
+
+#include <QRegExp>
+#include <QStringList>
+
+#include "iconset.h"
+
+/**
+ * Returns true if the icon's QRegExp is the plain alternation of its texts
+ * built by Iconset::load(), which means the texts alone describe it.
+ */
+static bool isPlainText(const PsiIcon *icon)
+{
+	if (icon->text().isEmpty())
+		return false;
+
+	QStringList regexp;
+	foreach(PsiIcon::IconText t, icon->text())
+		regexp += QRegExp::escape(t.text);
+	return icon->regExp().pattern() == regexp.join("|");
+}
+
+/**
+ * There must be whitespace at least on one side of the emoticon.
+ */
+static bool hasSpaceAround(const QString &str, int pos, int len)
+{
+	bool leftSpace  = pos == 0 || str[pos-1].isSpace();
+	bool rightSpace = pos + len == str.length() || str[pos+len].isSpace();
+	return leftSpace || rightSpace;
+}
+
+/**
+ * The closest match wins; at the same position the longer one, and then
+ * the one from the first iconset.
+ */
+static bool isBetter(const EmoticonMatcher::Match &best, int bestOrder, int pos, int len, int order)
+{
+	if (best.pos == -1 || pos < best.pos)
+		return true;
+	if (pos > best.pos)
+		return false;
+	return len > best.len || (len == best.len && order < bestOrder);
+}
+
+EmoticonMatcher::EmoticonMatcher(const Q3PtrList<Iconset> &iconsets)
+	: maxLen_(0)
+{
+	nodes_.append(Node());
+
+	int order = 0;
+	Q3PtrListIterator<Iconset> isit(iconsets);
+	for (Iconset *iconset; (iconset = isit.current()) != 0; ++isit) {
+		QListIterator<PsiIcon*> it = iconset->iterator();
+		while (it.hasNext()) {
+			PsiIcon *icon = it.next();
+			if (icon->regExp().isEmpty())
+				continue;
+
+			if (isPlainText(icon)) {
+				foreach(PsiIcon::IconText t, icon->text())
+					addPattern(t.text, order, icon);
+			}
+			else {
+				Pattern p;
+				p.len = 0;
+				p.order = order;
+				p.icon = icon;
+				regExpIcons_ += p;
+			}
+			++order;
+		}
+	}
+
+	build();
+}
+
+void EmoticonMatcher::addPattern(const QString &text, int order, PsiIcon *icon)
+{
+	if (text.isEmpty())
+		return;
+
+	int n = 0;
+	for (int i = 0; i < text.length(); ++i) {
+		ushort c = text[i].unicode();
+		int next = nodes_[n].next.value(c, -1);
+		if (next == -1) {
+			next = nodes_.count();
+			nodes_.append(Node());
+			nodes_[n].next.insert(c, next);
+		}
+		n = next;
+	}
+
+	// the same text in a later icon never wins
+	if (nodes_[n].pattern != -1)
+		return;
+
+	Pattern p;
+	p.len = text.length();
+	p.order = order;
+	p.icon = icon;
+	nodes_[n].pattern = patterns_.count();
+	patterns_.append(p);
+	maxLen_ = qMax(maxLen_, p.len);
+}
+
+/**
+ * Computes the failure links breadth-first and collects, for every node,
+ * all patterns that end there.
+ */
+void EmoticonMatcher::build()
+{
+	for (int n = 0; n < nodes_.count(); ++n)
+		if (nodes_[n].pattern != -1)
+			nodes_[n].out += nodes_[n].pattern;
+
+	QList<int> queue;
+	queue += 0;
+	while (!queue.isEmpty()) {
+		int n = queue.takeFirst();
+
+		QHash<ushort, int>::ConstIterator it = nodes_[n].next.constBegin();
+		for (; it != nodes_[n].next.constEnd(); ++it) {
+			int child = it.value();
+			int f = nodes_[n].fail;
+			while (n != 0 && f != 0 && !nodes_[f].next.contains(it.key()))
+				f = nodes_[f].fail;
+			int target = (n == 0) ? 0 : nodes_[f].next.value(it.key(), 0);
+			nodes_[child].fail = target;
+			nodes_[child].out += nodes_[target].out;
+			queue += child;
+		}
+	}
+}
+
+/**
+ * Finds the first emoticon in \a str at or after \a from that has
+ * whitespace on at least one side.  Returns false if there is none.
+ */
+bool EmoticonMatcher::findNext(const QString &str, int from, Match *match) const
+{
+	Match best;
+	best.pos = -1;
+	best.len = 0;
+	best.icon = 0;
+	int bestOrder = 0;
+
+	int n = 0;
+	for (int i = from; i < str.length(); ++i) {
+		// nothing ending here can start at or before the best match
+		if (best.pos != -1 && i >= best.pos + maxLen_)
+			break;
+
+		ushort c = str[i].unicode();
+		while (n != 0 && !nodes_[n].next.contains(c))
+			n = nodes_[n].fail;
+		n = nodes_[n].next.value(c, 0);
+
+		foreach(int p, nodes_[n].out) {
+			const Pattern &pt = patterns_[p];
+			int pos = i - pt.len + 1;
+			if (isBetter(best, bestOrder, pos, pt.len, pt.order) && hasSpaceAround(str, pos, pt.len)) {
+				best.pos = pos;
+				best.len = pt.len;
+				best.icon = pt.icon;
+				bestOrder = pt.order;
+			}
+		}
+	}
+
+	foreach(const Pattern &pt, regExpIcons_) {
+		const QRegExp &rx = pt.icon->regExp();
+		int pos = from;
+		int found;
+		while ((found = rx.indexIn(str, pos)) != -1) {
+			int len = rx.matchedLength();
+			if (!isBetter(best, bestOrder, found, len, pt.order))
+				break;
+			if (hasSpaceAround(str, found, len)) {
+				best.pos = found;
+				best.len = len;
+				best.icon = pt.icon;
+				bestOrder = pt.order;
+				break;
+			}
+			pos = found + qMax(len, 1);
+		}
+	}
+
+	if (best.pos == -1)
+		return false;
+
+	*match = best;
+	return true;
+}
@@ -0,0 +1,76 @@
+/*
+ * emoticonmatcher.h - finds emoticons in plain text
+ * Copyright (C) 2008  Psi Development Team
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef EMOTICONMATCHER_H
+#define EMOTICONMATCHER_H
+
+#include <QHash>
+#include <QList>
+#include <QVector>
+#include <Q3PtrList>
+
+class QString;
+class Iconset;
+class PsiIcon;
+
+/**
+ * Multi-pattern matcher for the texts of a list of emoticon iconsets.
+ * Plain emoticon texts are compiled into one Aho-Corasick automaton, so
+ * a chunk of text is scanned once no matter how many emoticons there are.
+ * Icons with hand-written regular expressions are searched with QRegExp.
+ */
+class EmoticonMatcher
+{
+public:
+	EmoticonMatcher(const Q3PtrList<Iconset> &iconsets);
+
+	struct Match {
+		int pos;
+		int len;
+		PsiIcon *icon;
+	};
+
+	bool findNext(const QString &str, int from, Match *match) const;
+
+private:
+	struct Pattern {
+		int len;
+		int order;
+		PsiIcon *icon;
+	};
+
+	struct Node {
+		Node() : fail(0), pattern(-1) { }
+		QHash<ushort, int> next;
+		int fail;
+		int pattern;
+		QList<int> out; // indexes into patterns_, including those of fail nodes
+	};
+
+	void addPattern(const QString &text, int order, PsiIcon *icon);
+	void build();
+
+	QVector<Node> nodes_;
+	QVector<Pattern> patterns_;
+	QList<Pattern> regExpIcons_;
+	int maxLen_;
+};
+
+#endif
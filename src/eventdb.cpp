@@ -20,13 +20,24 @@
 
 #include "eventdb.h"
 
-#define FAKEDELAY 0
+#include <string.h>
 
 #include <QVector>
+#include <QStringList>
 #include <QFileInfo>
 #include <QDir>
+#include <QDataStream>
+#include <QHash>
+#include <QMap>
+#include <QSet>
+#include <QDateTime>
+#include <QtAlgorithms>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QWaitCondition>
+#include <QThread>
+#include <QCoreApplication>
 #include <q3ptrlist.h>
-#include <qtimer.h>
 #include <qtextstream.h>
 
 #include "common.h"
@@ -139,6 +150,17 @@ void EDBHandle::find(const QString &str, const Jid &j, const QString &id, int di
 	d->listeningFor = d->edb->op_find(str, j, id, direction);
 }
 
+/**
+ * Looks for all events matching \a str.  The items of the result only
+ * carry the ids of the matches, their events are null.
+ */
+void EDBHandle::findAll(const QString &str, const Jid &j)
+{
+	d->busy = true;
+	d->lastRequestType = Read;
+	d->listeningFor = d->edb->op_findAll(str, j);
+}
+
 void EDBHandle::append(const Jid &j, PsiEvent *e)
 {
 	d->busy = true;
@@ -153,6 +175,16 @@ void EDBHandle::erase(const Jid &j)
 	d->listeningFor = d->edb->op_erase(j);
 }
 
+/**
+ * Rewrites the history of \a j in the compact binary format.
+ */
+void EDBHandle::convert(const Jid &j)
+{
+	d->busy = true;
+	d->lastRequestType = Convert;
+	d->listeningFor = d->edb->op_convert(j);
+}
+
 bool EDBHandle::busy() const
 {
 	return d->busy;
@@ -226,6 +258,14 @@ EDB::~EDB()
 	delete d;
 }
 
+/**
+ * Makes sure that all buffered writes are carried out soon.  Databases
+ * that don't buffer writes don't need to do anything.
+ */
+void EDB::flush()
+{
+}
+
 int EDB::genUniqueId() const
 {
 	return d->reqid_base++;
@@ -261,6 +301,11 @@ int EDB::op_find(const QString &str, const Jid &j, const QString &id, int direct
 	return find(str, j, id, direction);
 }
 
+int EDB::op_findAll(const QString &str, const Jid &j)
+{
+	return findAll(str, j);
+}
+
 int EDB::op_append(const Jid &j, PsiEvent *e)
 {
 	return append(j, e);
@@ -271,6 +316,11 @@ int EDB::op_erase(const Jid &j)
 	return erase(j);
 }
 
+int EDB::op_convert(const Jid &j)
+{
+	return convert(j);
+}
+
 void EDB::resultReady(int req, EDBResult *r)
 {
 	// deliver
@@ -317,34 +367,181 @@ struct item_file_req
 		Type_get,
 		Type_append,
 		Type_find,
-		Type_erase
+		Type_erase,
+		Type_findAll,
+		Type_flush,
+		Type_convert
 	};
 };
 
+//----------------------------------------------------------------------------
+// EDBFlatFile::Thread
+//----------------------------------------------------------------------------
+
+// All file I/O is done in a dedicated thread, so that neither big reads nor
+// writes for incoming messages block the GUI.  Requests are queued under
+// the mutex, and the results are posted back to the EDBFlatFile object,
+// which lives in the GUI thread, as events.
+
+#define EDB_RESULT_EVENT       ((QEvent::Type)(QEvent::User + 1))
+#define EDB_WRITEFINISHED_EVENT ((QEvent::Type)(QEvent::User + 2))
+
+// files that haven't been touched for this long are closed
+#define EDB_FILE_IDLE_TIMEOUT 30000
+
+// appends are buffered, and written to each file at most every
+// EDB_APPEND_DELAY msecs, or once EDB_APPEND_BATCH of them are queued
+#define EDB_APPEND_DELAY 500
+#define EDB_APPEND_BATCH 100
+
+class EDBResultEvent : public QEvent
+{
+public:
+	EDBResultEvent(int _req, EDBResult *_result)
+	: QEvent(EDB_RESULT_EVENT)
+	{
+		req = _req;
+		result = _result;
+	}
+
+	~EDBResultEvent()
+	{
+		// not delivered
+		delete result;
+	}
+
+	int req;
+	EDBResult *result;
+};
+
+class EDBWriteFinishedEvent : public QEvent
+{
+public:
+	EDBWriteFinishedEvent(int _req, bool _success)
+	: QEvent(EDB_WRITEFINISHED_EVENT)
+	{
+		req = _req;
+		success = _success;
+	}
+
+	int req;
+	bool success;
+};
+
+class EDBFlatFile::Thread : public QThread
+{
+public:
+	Thread(EDBFlatFile *_edb)
+	{
+		edb = _edb;
+	}
+
+protected:
+	void run();
+
+private:
+	EDBFlatFile *edb;
+};
+
 class EDBFlatFile::Private
 {
 public:
 	Private() {}
 
+	// only touched by the I/O thread
 	Q3PtrList<File> flist;
-	Q3PtrList<item_file_req> rlist;
+	QSet<QString> convertFailed;
+
+	// guarded by mutex
+	QMutex mutex;
+	QWaitCondition cond;
+	QList<item_file_req*> rlist;
+	bool quit;
+	bool binaryFormat;
+
+	Thread *thread;
 };
 
+void EDBFlatFile::Thread::run()
+{
+	Private *d = edb->d;
+
+	d->mutex.lock();
+	while (1) {
+		if (d->rlist.isEmpty()) {
+			// on shutdown, pending requests are still carried out
+			if (d->quit)
+				break;
+			d->cond.wait(&d->mutex, edb->hasPendingAppends() ? EDB_APPEND_DELAY : EDB_FILE_IDLE_TIMEOUT);
+		}
+
+		QList<item_file_req*> batch = d->rlist;
+		d->rlist.clear();
+		d->mutex.unlock();
+
+		edb->performRequests(batch);
+		edb->commitAppends(false);
+		edb->closeIdleFiles();
+
+		d->mutex.lock();
+	}
+	d->mutex.unlock();
+
+	edb->commitAppends(true);
+}
+
 EDBFlatFile::EDBFlatFile()
 :EDB()
 {
 	d = new Private;
+	d->quit = false;
+	d->binaryFormat = false;
+	d->thread = new Thread(this);
+	d->thread->start(QThread::LowPriority);
 }
 
 EDBFlatFile::~EDBFlatFile()
 {
-	d->rlist.setAutoDelete(true);
+	d->mutex.lock();
+	d->quit = true;
+	d->cond.wakeAll();
+	d->mutex.unlock();
+	d->thread->wait();
+	delete d->thread;
+
+	// results posted by the thread are of no use anymore
+	QCoreApplication::removePostedEvents(this);
+
 	d->flist.setAutoDelete(true);
 	d->flist.clear();
 
 	delete d;
 }
 
+void EDBFlatFile::queueRequest(item_file_req *r)
+{
+	QMutexLocker locker(&d->mutex);
+	d->rlist.append(r);
+	d->cond.wakeAll();
+}
+
+bool EDBFlatFile::event(QEvent *e)
+{
+	if (e->type() == EDB_RESULT_EVENT) {
+		EDBResultEvent *re = static_cast<EDBResultEvent*>(e);
+		EDBResult *result = re->result;
+		re->result = 0;
+		resultReady(re->req, result);
+		return true;
+	}
+	else if (e->type() == EDB_WRITEFINISHED_EVENT) {
+		EDBWriteFinishedEvent *we = static_cast<EDBWriteFinishedEvent*>(e);
+		writeFinished(we->req, we->success);
+		return true;
+	}
+	return EDB::event(e);
+}
+
 int EDBFlatFile::getLatest(const Jid &j, int len)
 {
 	item_file_req *r = new item_file_req;
@@ -352,9 +549,7 @@ int EDBFlatFile::getLatest(const Jid &j, int len)
 	r->type = item_file_req::Type_getLatest;
 	r->len = len < 1 ? 1: len;
 	r->id = genUniqueId();
-	d->rlist.append(r);
-
-	QTimer::singleShot(FAKEDELAY, this, SLOT(performRequests()));
+	queueRequest(r);
 	return r->id;
 }
 
@@ -365,9 +560,7 @@ int EDBFlatFile::getOldest(const Jid &j, int len)
 	r->type = item_file_req::Type_getOldest;
 	r->len = len < 1 ? 1: len;
 	r->id = genUniqueId();
-	d->rlist.append(r);
-
-	QTimer::singleShot(FAKEDELAY, this, SLOT(performRequests()));
+	queueRequest(r);
 	return r->id;
 }
 
@@ -380,9 +573,7 @@ int EDBFlatFile::get(const Jid &j, const QString &id, int direction, int len)
 	r->dir = direction;
 	r->eventId = id.toInt();
 	r->id = genUniqueId();
-	d->rlist.append(r);
-
-	QTimer::singleShot(FAKEDELAY, this, SLOT(performRequests()));
+	queueRequest(r);
 	return r->id;
 }
 
@@ -396,9 +587,19 @@ int EDBFlatFile::find(const QString &str, const Jid &j, const QString &id, int d
 	r->findStr = str;
 	r->eventId = id.toInt();
 	r->id = genUniqueId();
-	d->rlist.append(r);
+	queueRequest(r);
+	return r->id;
+}
 
-	QTimer::singleShot(FAKEDELAY, this, SLOT(performRequests()));
+int EDBFlatFile::findAll(const QString &str, const Jid &j)
+{
+	item_file_req *r = new item_file_req;
+	r->j = j;
+	r->type = item_file_req::Type_findAll;
+	r->len = 0;
+	r->findStr = str;
+	r->id = genUniqueId();
+	queueRequest(r);
 	return r->id;
 }
 
@@ -413,10 +614,44 @@ int EDBFlatFile::append(const Jid &j, PsiEvent *e)
 		delete r;
 		return 0;
 	}
+	// the copy is written and deleted by the I/O thread
+	r->event->moveToThread(d->thread);
 	r->id = genUniqueId();
-	d->rlist.append(r);
+	queueRequest(r);
+	return r->id;
+}
+
+void EDBFlatFile::flush()
+{
+	item_file_req *r = new item_file_req;
+	r->type = item_file_req::Type_flush;
+	r->event = 0;
+	r->id = -1;
+	queueRequest(r);
+}
 
-	QTimer::singleShot(FAKEDELAY, this, SLOT(performRequests()));
+/**
+ * Makes new history files use the binary format instead of the text
+ * format, which older versions of Psi can read.
+ */
+void EDBFlatFile::setBinaryFormat(bool binary)
+{
+	QMutexLocker locker(&d->mutex);
+	d->binaryFormat = binary;
+}
+
+/**
+ * Rewrites the history of \a j in the binary format, if it is a text
+ * file.  The conversion isn't attempted again in this session if it fails.
+ */
+int EDBFlatFile::convert(const Jid &j)
+{
+	item_file_req *r = new item_file_req;
+	r->j = j;
+	r->type = item_file_req::Type_convert;
+	r->event = 0;
+	r->id = genUniqueId();
+	queueRequest(r);
 	return r->id;
 }
 
@@ -427,12 +662,23 @@ int EDBFlatFile::erase(const Jid &j)
 	r->type = item_file_req::Type_erase;
 	r->event = 0;
 	r->id = genUniqueId();
-	d->rlist.append(r);
-
-	QTimer::singleShot(FAKEDELAY, this, SLOT(performRequests()));
+	queueRequest(r);
 	return r->id;
 }
 
+EDBItem *EDBFlatFile::makeItem(File *f, PsiEvent *e, int id) const
+{
+	QString prevId, nextId;
+	if(id > 0)
+		prevId = QString::number(id-1);
+	if(id < f->total()-1)
+		nextId = QString::number(id+1);
+	// the event is handed over to the GUI thread
+	if(e)
+		e->moveToThread(thread());
+	return new EDBItem(e, QString::number(id), prevId, nextId);
+}
+
 EDBFlatFile::File *EDBFlatFile::findFile(const Jid &j) const
 {
 	Q3PtrListIterator<File> it(d->flist);
@@ -447,8 +693,11 @@ EDBFlatFile::File *EDBFlatFile::ensureFile(const Jid &j)
 {
 	File *i = findFile(j);
 	if(!i) {
-		i = new File(Jid(j.userHost()));
-		connect(i, SIGNAL(timeout()), SLOT(file_timeout()));
+		d->mutex.lock();
+		bool binary = d->binaryFormat;
+		d->mutex.unlock();
+
+		i = new File(Jid(j.userHost()), binary);
 		d->flist.append(i);
 	}
 	return i;
@@ -468,6 +717,10 @@ bool EDBFlatFile::deleteFile(const Jid &j)
 	else {
 		fname = File::jidToFileName(j);
 	}
+	d->convertFailed.remove(fname);
+
+	QFile::remove(File::indexFileName(fname));
+	QFile::remove(File::wordIndexFileName(fname));
 
 	QFileInfo fi(fname);
 	if(fi.exists()) {
@@ -478,16 +731,46 @@ bool EDBFlatFile::deleteFile(const Jid &j)
 		return true;
 }
 
-void EDBFlatFile::performRequests()
+/**
+ * Carries out a batch of requests in the I/O thread.  Requests for the same
+ * file are handled together, in the order they were made.
+ */
+void EDBFlatFile::performRequests(const QList<item_file_req*> &batch)
 {
-	if(d->rlist.isEmpty())
-		return;
+	QStringList order;
+	QHash<QString, QList<item_file_req*> > byFile;
+	bool flush = false;
+	foreach(item_file_req *r, batch) {
+		if(r->type == item_file_req::Type_flush) {
+			flush = true;
+			delete r;
+			continue;
+		}
 
-	item_file_req *r = d->rlist.first();
-	d->rlist.removeRef(r);
+		QString key = r->j.userHost();
+		if(!byFile.contains(key))
+			order += key;
+		byFile[key] += r;
+	}
 
+	foreach(QString key, order) {
+		foreach(item_file_req *r, byFile[key])
+			performRequest(r);
+	}
+
+	if(flush)
+		commitAppends(true);
+}
+
+void EDBFlatFile::performRequest(item_file_req *r)
+{
 	File *f = ensureFile(r->j);
 	int type = r->type;
+
+	// everything but appends has to see the events written before
+	if(type != item_file_req::Type_append)
+		commitFile(f);
+
 	if(type >= item_file_req::Type_getLatest && type <= item_file_req::Type_get) {
 		int id, direction;
 
@@ -504,7 +787,8 @@ void EDBFlatFile::performRequests()
 			id = r->eventId;
 		}
 		else {
-			qWarning("EDBFlatFile::performRequests(): Invalid type.");
+			qWarning("EDBFlatFile::performRequest(): Invalid type.");
+			delete r;
 			return;
 		}
 
@@ -526,77 +810,233 @@ void EDBFlatFile::performRequests()
 		result->setAutoDelete(true);
 		for(int n = 0; n < len; ++n) {
 			PsiEvent *e = f->get(id);
-			if(e) {
-				QString prevId, nextId;
-				if(id > 0)
-					prevId = QString::number(id-1);
-				if(id < f->total()-1)
-					nextId = QString::number(id+1);
-				EDBItem *ei = new EDBItem(e, QString::number(id), prevId, nextId);
-				result->append(ei);
-			}
+			if(e)
+				result->append(makeItem(f, e, id));
 
 			if(direction == Forward)
 				++id;
 			else
 				--id;
 		}
-		resultReady(r->id, result);
+		QCoreApplication::postEvent(this, new EDBResultEvent(r->id, result));
 	}
 	else if(type == item_file_req::Type_append) {
-		writeFinished(r->id, f->append(r->event));
-		delete r->event;
+		f->queueAppend(r->id, r->event);
+		if(f->pendingCount() >= EDB_APPEND_BATCH)
+			commitFile(f);
 	}
 	else if(type == item_file_req::Type_find) {
 		int id = r->eventId;
 		EDBResult *result = new EDBResult;
 		result->setAutoDelete(true);
-		while(1) {
-			PsiEvent *e = f->get(id);
-			if(!e)
-				break;
 
-			QString prevId, nextId;
-			if(id > 0)
-				prevId = QString::number(id-1);
-			if(id < f->total()-1)
-				nextId = QString::number(id+1);
-
-			if(e->type() == PsiEvent::Message) {
-				MessageEvent *me = (MessageEvent *)e;
-				const Message &m = me->message();
-				if(m.body().find(r->findStr, 0, false) != -1) {
-					EDBItem *ei = new EDBItem(e, QString::number(id), prevId, nextId);
-					result->append(ei);
+		QVector<int> candidates;
+		if(f->findCandidates(r->findStr, &candidates)) {
+			// only look at the events that contain all the words
+			int at;
+			if(r->dir == Forward) {
+				at = qLowerBound(candidates.begin(), candidates.end(), id) - candidates.begin();
+			}
+			else {
+				at = qUpperBound(candidates.begin(), candidates.end(), id) - candidates.begin() - 1;
+			}
+			while(at >= 0 && at < candidates.size()) {
+				PsiEvent *e = f->get(candidates[at]);
+				if(e) {
+					if(File::matches(e, r->findStr)) {
+						result->append(makeItem(f, e, candidates[at]));
+						break;
+					}
+					delete e;
+				}
+
+				if(r->dir == Forward)
+					++at;
+				else
+					--at;
+			}
+		}
+		else {
+			while(1) {
+				PsiEvent *e = f->get(id);
+				if(!e)
+					break;
+
+				if(File::matches(e, r->findStr)) {
+					result->append(makeItem(f, e, id));
 					break;
 				}
+				delete e;
+
+				if(r->dir == Forward)
+					++id;
+				else
+					--id;
 			}
+		}
+		QCoreApplication::postEvent(this, new EDBResultEvent(r->id, result));
+	}
+	else if(type == item_file_req::Type_findAll) {
+		EDBResult *result = new EDBResult;
+		result->setAutoDelete(true);
 
-			if(r->dir == Forward)
-				++id;
-			else
-				--id;
+		QVector<int> candidates;
+		if(!f->findCandidates(r->findStr, &candidates)) {
+			candidates.resize(f->total());
+			for(int n = 0; n < candidates.size(); ++n)
+				candidates[n] = n;
+		}
+		// only the ids are handed back, the events are fetched when shown
+		foreach(int id, candidates) {
+			PsiEvent *e = f->get(id);
+			if(!e)
+				continue;
+			if(File::matches(e, r->findStr))
+				result->append(makeItem(f, 0, id));
+			delete e;
 		}
-		resultReady(r->id, result);
+		QCoreApplication::postEvent(this, new EDBResultEvent(r->id, result));
 	}
 	else if(type == item_file_req::Type_erase) {
-		writeFinished(r->id, deleteFile(f->j));
+		QCoreApplication::postEvent(this, new EDBWriteFinishedEvent(r->id, deleteFile(f->j)));
+	}
+	else if(type == item_file_req::Type_convert) {
+		bool ok = false;
+		if(!d->convertFailed.contains(f->fname)) {
+			ok = f->convert();
+			if(!ok)
+				d->convertFailed += f->fname;
+		}
+		QCoreApplication::postEvent(this, new EDBWriteFinishedEvent(r->id, ok));
 	}
 
 	delete r;
 }
 
-void EDBFlatFile::file_timeout()
+void EDBFlatFile::commitFile(File *f)
 {
-	File *i = (File *)sender();
-	d->flist.remove(i);
-	i->deleteLater();
+	QList< QPair<int, bool> > results = f->commit();
+	for(int n = 0; n < results.count(); ++n)
+		QCoreApplication::postEvent(this, new EDBWriteFinishedEvent(results[n].first, results[n].second));
+}
+
+/**
+ * Writes out the buffered appends that are due, or all of them if \a all
+ * is true.
+ */
+void EDBFlatFile::commitAppends(bool all)
+{
+	Q3PtrListIterator<File> it(d->flist);
+	for(File *i; (i = it.current()); ++it) {
+		if(all ? i->pendingCount() > 0 : i->pendingDue())
+			commitFile(i);
+	}
+}
+
+bool EDBFlatFile::hasPendingAppends() const
+{
+	Q3PtrListIterator<File> it(d->flist);
+	for(File *i; (i = it.current()); ++it) {
+		if(i->pendingCount() > 0)
+			return true;
+	}
+	return false;
+}
+
+void EDBFlatFile::closeIdleFiles()
+{
+	Q3PtrListIterator<File> it(d->flist);
+	for(File *i; (i = it.current());) {
+		++it;
+		if(i->idle()) {
+			commitFile(i);
+			d->flist.removeRef(i);
+			delete i;
+		}
+	}
 }
 
 
 //----------------------------------------------------------------------------
 // EDBFlatFile::File
 //----------------------------------------------------------------------------
+
+// The line index of every .history file is kept in a sidecar file next to
+// it, so that it doesn't have to be rebuilt each time the log is reopened.
+// It consists of a small header followed by the offset of every line.
+#define EDB_INDEX_MAGIC   0x50534958 // "PSIX"
+#define EDB_INDEX_VERSION 1
+#define EDB_INDEX_HEADER  8
+
+// The word index maps every word found in message bodies to the (ascending)
+// ids of the events containing it.  It is used to narrow down the events
+// that have to be decoded when searching.  Its sidecar holds a header
+// followed by the list of words of every event, so that new events are
+// simply appended to it.
+#define EDB_WORDS_MAGIC   0x50535757 // "PSWW"
+#define EDB_WORDS_VERSION 2
+
+typedef QMap<QString, QVector<int> > EDBWordIndex;
+
+// History files are either in the legacy text format, one escaped line per
+// event, or in the binary format: a header followed by records of
+//
+//   quint32 length of the rest of the record
+//   quint8  event type (same numbers as in the text format)
+//   quint8  flags (EDB_RECORD_LOCAL)
+//   qint64  timestamp, seconds since the epoch, or -1
+//   subject, url, url description, body: quint32 length + UTF-8 data each
+//
+// with all integers in little endian.  The format of a file is detected when
+// it is opened, and both are read and appended to.  New files are created
+// in the text format unless EDBFlatFile::setBinaryFormat() was called, and
+// text files are only converted on request, by EDBFlatFile::convert().
+#define EDB_RECORD_MAGIC      "PSIHIST1"
+#define EDB_RECORD_HEADER     8
+#define EDB_RECORD_FIXED      10
+#define EDB_RECORD_LOCAL      0x01
+
+static inline void edbPut32(QByteArray &buf, quint32 v)
+{
+	char c[4] = { char(v), char(v >> 8), char(v >> 16), char(v >> 24) };
+	buf.append(QByteArray(c, 4));
+}
+
+static inline quint32 edbGet32(const uchar *p)
+{
+	return quint32(p[0]) | (quint32(p[1]) << 8) | (quint32(p[2]) << 16) | (quint32(p[3]) << 24);
+}
+
+static inline void edbPutString(QByteArray &buf, const QString &str)
+{
+	QByteArray utf8 = str.toUtf8();
+	edbPut32(buf, utf8.size());
+	buf += utf8;
+}
+
+/**
+ * Splits \a str into lowercase words (runs of letters and digits), in the
+ * order they appear.
+ */
+static QStringList edbWords(const QString &str)
+{
+	QStringList words;
+	const QChar *uc = str.unicode();
+	int len = str.length();
+	int start = -1;
+	for (int n = 0; n <= len; ++n) {
+		if (n < len && uc[n].isLetterOrNumber()) {
+			if (start == -1)
+				start = n;
+		}
+		else if (start != -1) {
+			words += str.mid(start, n - start).toLower();
+			start = -1;
+		}
+	}
+	return words;
+}
+
 class EDBFlatFile::File::Private
 {
 public:
@@ -604,30 +1044,59 @@ public:
 
 	QVector<quint64> index;
 	bool indexed;
+	int indexOnDisk;   // number of offsets already stored in the sidecar
+	uchar *map;
+	qint64 mapSize;
+	bool binary;
+
+	// appends waiting to be written
+	QList<int> pendingReqs;
+	QList<PsiEvent*> pendingEvents;
+	QTime pendingSince;
+
+	EDBWordIndex words;
+	bool wordsIndexed;
+	int wordsCovered;  // number of events that were added to the word index
+	int wordsOnDisk;   // number of events stored in the sidecar
 };
 
-EDBFlatFile::File::File(const Jid &_j)
+EDBFlatFile::File::File(const Jid &_j, bool binary)
 {
 	d = new Private;
 	d->indexed = false;
+	d->indexOnDisk = 0;
+	d->map = 0;
+	d->mapSize = 0;
+	d->wordsIndexed = false;
+	d->wordsCovered = 0;
+	d->wordsOnDisk = 0;
 
 	j = _j;
 	valid = false;
-	t = new QTimer(this);
-	connect(t, SIGNAL(timeout()), SLOT(timer_timeout()));
 
 	//printf("[EDB opening -- %s]\n", j.full().latin1());
 	fname = jidToFileName(_j);
 	f.setName(fname);
 	valid = f.open(QIODevice::ReadWrite);
 
+	// the format of new files is up to the caller
+	d->binary = binary;
+	if(valid && f.size() > 0) {
+		char magic[EDB_RECORD_HEADER];
+		d->binary = f.read(magic, EDB_RECORD_HEADER) == EDB_RECORD_HEADER && memcmp(magic, EDB_RECORD_MAGIC, EDB_RECORD_HEADER) == 0;
+	}
+
 	touch();
 }
 
 EDBFlatFile::File::~File()
 {
-	if(valid)
+	qDeleteAll(d->pendingEvents);
+
+	if(valid) {
+		unmap();
 		f.close();
+	}
 	//printf("[EDB closing -- %s]\n", j.full().latin1());
 
 	delete d;
@@ -638,38 +1107,253 @@ QString EDBFlatFile::File::jidToFileName(const XMPP::Jid &j)
 	return ApplicationInfo::historyDir() + "/" + JIDUtil::encode(j.userHost()).toLower() + ".history";
 }
 
-void EDBFlatFile::File::ensureIndex()
+QString EDBFlatFile::File::indexFileName(const QString &historyFileName)
 {
-	if ( valid && !d->indexed ) {
-		if (f.isSequential()) {
-			qWarning("EDBFlatFile::File::ensureIndex(): Can't index sequential files.");
-			return;
+	return historyFileName + ".idx";
+}
+
+QString EDBFlatFile::File::wordIndexFileName(const QString &historyFileName)
+{
+	return historyFileName + ".words";
+}
+
+/**
+ * Maps the whole history file into memory, if possible. Returns 0 when
+ * mapping is not available, in which case the caller falls back to
+ * ordinary reads.
+ */
+uchar *EDBFlatFile::File::ensureMap()
+{
+#if QT_VERSION >= 0x040400
+	if (!d->map) {
+		qint64 size = f.size();
+		if (size > 0) {
+			d->map = f.map(0, size);
+			if (d->map)
+				d->mapSize = size;
 		}
+	}
+	return d->map;
+#else
+	return 0;
+#endif
+}
 
-		f.reset(); // go to beginning
+void EDBFlatFile::File::unmap()
+{
+#if QT_VERSION >= 0x040400
+	if (d->map)
+		f.unmap(d->map);
+#endif
+	d->map = 0;
+	d->mapSize = 0;
+}
+
+/**
+ * Adds the offsets of all complete lines or records found after position
+ * \a from to the index.
+ */
+void EDBFlatFile::File::scanIndex(qint64 from)
+{
+	if (d->binary) {
+		qint64 at = from;
+		while (1) {
+			qint64 end = recordEnd(at);
+			if (end < 0)
+				break;
+			d->index.append(at);
+			at = end;
+		}
+		return;
+	}
+
+	const uchar *map = ensureMap();
+	if (map) {
+		qint64 at = from;
+		while (at < d->mapSize) {
+			const void *nl = memchr(map + at, '\n', d->mapSize - at);
+			if (!nl)
+				break;
+			d->index.append(at);
+			at = (const uchar *)nl - map + 1;
+		}
+		return;
+	}
+
+	if (!f.seek(from))
+		return;
+
+	qint64 lineStart = from;
+	qint64 blockStart = from;
+	while (1) {
+		QByteArray block = f.read(65536);
+		if (block.isEmpty())
+			break;
+
+		const char *data = block.constData();
+		int at = 0;
+		while (at < block.size()) {
+			const char *nl = (const char *)memchr(data + at, '\n', block.size() - at);
+			if (!nl)
+				break;
+			d->index.append(lineStart);
+			at = nl - data + 1;
+			lineStart = blockStart + at;
+		}
+		blockStart += block.size();
+	}
+}
+
+/**
+ * Reads the sidecar index and brings it up to date with lines appended to
+ * the history file since it was written (e.g. by an older version of Psi).
+ * Returns false if there is no usable index, in which case it has to be
+ * rebuilt from scratch.
+ */
+bool EDBFlatFile::File::loadIndex()
+{
+	QFile idx(indexFileName(fname));
+	if (!idx.open(QIODevice::ReadOnly))
+		return false;
+
+	qint64 count = (idx.size() - EDB_INDEX_HEADER) / sizeof(quint64);
+	if (count < 0)
+		return false;
+
+	QDataStream in(&idx);
+	in.setVersion(QDataStream::Qt_4_2);
+	quint32 magic, version;
+	in >> magic >> version;
+	if (magic != EDB_INDEX_MAGIC || version != EDB_INDEX_VERSION)
+		return false;
+
+	d->index.resize(count);
+	for (int n = 0; n < count; ++n)
+		in >> d->index[n];
+	if (in.status() != QDataStream::Ok) {
 		d->index.clear();
+		return false;
+	}
+	idx.close();
+
+	// make sure the index still describes this file
+	qint64 scanFrom = firstOffset();
+	if (!d->index.isEmpty()) {
+		quint64 last = d->index.last();
+		if (d->index.first() != (quint64)firstOffset() || last >= (quint64)f.size()) {
+			d->index.clear();
+			return false;
+		}
 
-		//printf(" file: %s\n", fname.latin1());
-		// build index
-		while(1) {
-			quint64 at = f.pos();
-
-			// locate a newline
-			bool found = false;
-			char c;
-			while (f.getChar(&c)) {
-				if (c == '\n') {
-					found = true;
-					break;
-				}
+		if (!d->binary && last > 0) {
+			char c = 0;
+			f.seek(last - 1);
+			f.getChar(&c);
+			if (c != '\n') {
+				d->index.clear();
+				return false;
 			}
+		}
 
-			if(!found)
-				break;
+		scanFrom = recordEnd(last);
+		if (scanFrom < 0) {
+			d->index.clear();
+			return false;
+		}
+	}
 
-			int oldsize = d->index.size();
-			d->index.resize(oldsize+1);
-			d->index[oldsize] = at;
+	d->indexOnDisk = d->index.size();
+	scanIndex(scanFrom);
+	appendIndex(d->indexOnDisk);
+	return true;
+}
+
+qint64 EDBFlatFile::File::firstOffset() const
+{
+	return d->binary ? EDB_RECORD_HEADER : 0;
+}
+
+/**
+ * Returns the position following the complete line or record starting at
+ * \a at, or -1 if there is none.
+ */
+qint64 EDBFlatFile::File::recordEnd(qint64 at)
+{
+	qint64 size = f.size();
+	if (d->binary) {
+		uchar len[4];
+		const uchar *map = ensureMap();
+		if (map && at + 4 <= d->mapSize) {
+			memcpy(len, map + at, 4);
+		}
+		else if (!f.seek(at) || f.read((char *)len, 4) != 4) {
+			return -1;
+		}
+
+		qint64 end = at + 4 + edbGet32(len);
+		return end <= size ? end : -1;
+	}
+
+	if (!f.seek(at))
+		return -1;
+	QByteArray line = f.readLine();
+	if (!line.endsWith('\n'))
+		return -1;
+	return at + line.size();
+}
+
+void EDBFlatFile::File::saveIndex()
+{
+	QFile idx(indexFileName(fname));
+	if (!idx.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+		d->indexOnDisk = 0;
+		return;
+	}
+
+	QDataStream out(&idx);
+	out.setVersion(QDataStream::Qt_4_2);
+	out << (quint32)EDB_INDEX_MAGIC << (quint32)EDB_INDEX_VERSION;
+	for (int n = 0; n < d->index.size(); ++n)
+		out << d->index[n];
+	d->indexOnDisk = d->index.size();
+}
+
+/**
+ * Stores offsets starting at \a from in the sidecar index.
+ */
+void EDBFlatFile::File::appendIndex(int from)
+{
+	if (from >= d->index.size())
+		return;
+	if (from != d->indexOnDisk) {
+		saveIndex();
+		return;
+	}
+
+	QFile idx(indexFileName(fname));
+	if (!idx.open(QIODevice::WriteOnly | QIODevice::Append)) {
+		return;
+	}
+
+	QDataStream out(&idx);
+	out.setVersion(QDataStream::Qt_4_2);
+	for (int n = from; n < d->index.size(); ++n)
+		out << d->index[n];
+	d->indexOnDisk = d->index.size();
+}
+
+void EDBFlatFile::File::ensureIndex()
+{
+	if ( valid && !d->indexed ) {
+		if (f.isSequential()) {
+			qWarning("EDBFlatFile::File::ensureIndex(): Can't index sequential files.");
+			return;
+		}
+
+		if (!loadIndex()) {
+			d->index.clear();
+			scanIndex(firstOffset());
+			saveIndex();
 		}
 
 		d->indexed = true;
@@ -689,12 +1373,57 @@ int EDBFlatFile::File::total() const
 
 void EDBFlatFile::File::touch()
 {
-	t->start(30000);
+	lastAccess.start();
+}
+
+bool EDBFlatFile::File::idle() const
+{
+	return lastAccess.elapsed() > EDB_FILE_IDLE_TIMEOUT;
+}
+
+QString EDBFlatFile::File::readLine(quint64 at)
+{
+	const uchar *map = ensureMap();
+	if (map && (qint64)at < d->mapSize) {
+		const char *start = (const char *)map + at;
+		int len = d->mapSize - at;
+		const char *nl = (const char *)memchr(start, '\n', len);
+		if (nl)
+			len = nl - start;
+		if (len > 0 && start[len - 1] == '\r')
+			--len;
+		return QString::fromUtf8(start, len);
+	}
+
+	f.seek(at);
+	QByteArray line = f.readLine();
+	if (line.endsWith('\n'))
+		line.chop(1);
+	if (line.endsWith('\r'))
+		line.chop(1);
+	return QString::fromUtf8(line);
 }
 
-void EDBFlatFile::File::timer_timeout()
+/**
+ * Decodes the event stored at \a at, in whichever format the file uses.
+ */
+PsiEvent *EDBFlatFile::File::eventAt(quint64 at)
 {
-	timeout();
+	if (!d->binary)
+		return lineToEvent(readLine(at));
+
+	const uchar *map = ensureMap();
+	if (map && (qint64)at + 4 <= d->mapSize) {
+		quint32 len = edbGet32(map + at);
+		if ((qint64)at + 4 + len <= d->mapSize)
+			return recordToEvent(map + at + 4, len);
+	}
+
+	uchar buf[4];
+	if (!f.seek(at) || f.read((char *)buf, 4) != 4)
+		return 0;
+	QByteArray record = f.read(edbGet32(buf));
+	return recordToEvent((const uchar *)record.constData(), record.size());
 }
 
 PsiEvent *EDBFlatFile::File::get(int id)
@@ -705,45 +1434,366 @@ PsiEvent *EDBFlatFile::File::get(int id)
 		return 0;
 
 	ensureIndex();
-	if(id < 0 || id > (int)d->index.size())
+	if(id < 0 || id >= (int)d->index.size())
 		return 0;
 
-	f.seek(d->index[id]);
+	return eventAt(d->index[id]);
+}
+
+/**
+ * Queues \a e, which is owned by the file from now on, to be written by
+ * the next commit().
+ */
+void EDBFlatFile::File::queueAppend(int req, PsiEvent *e)
+{
+	touch();
 
-	QTextStream t;
-	t.setDevice(&f);
-	t.setEncoding(QTextStream::UnicodeUTF8);
-	QString line = t.readLine();
+	if(d->pendingEvents.isEmpty())
+		d->pendingSince.start();
+	d->pendingReqs += req;
+	d->pendingEvents += e;
+}
 
-	return lineToEvent(line);
+int EDBFlatFile::File::pendingCount() const
+{
+	return d->pendingEvents.count();
 }
 
-bool EDBFlatFile::File::append(PsiEvent *e)
+bool EDBFlatFile::File::pendingDue() const
 {
+	return !d->pendingEvents.isEmpty() && d->pendingSince.elapsed() >= EDB_APPEND_DELAY;
+}
+
+/**
+ * Writes all queued events with a single write, and returns whether
+ * each of the requests succeeded.
+ */
+QList< QPair<int, bool> > EDBFlatFile::File::commit()
+{
+	QList< QPair<int, bool> > results;
+	if(d->pendingEvents.isEmpty())
+		return results;
+
 	touch();
 
-	if(!valid)
+	qint64 end = valid ? f.size() : 0;
+
+	// drop what's left of a record that was only partly written, or the
+	// new records would be hidden behind it
+	if(valid && d->binary && end > 0)
+		ensureIndex();
+	if(valid && d->binary && d->indexed && end > 0) {
+		qint64 complete = d->index.isEmpty() ? firstOffset() : recordEnd(d->index.last());
+		if(complete >= 0 && complete < end) {
+			unmap();
+			if(f.resize(complete))
+				end = complete;
+		}
+	}
+
+	QByteArray data;
+	if(d->binary && end == 0)
+		data = EDB_RECORD_MAGIC;
+
+	QVector<quint64> offsets;
+	QList<PsiEvent*> written;
+	for(int n = 0; n < d->pendingEvents.count(); ++n) {
+		PsiEvent *e = d->pendingEvents[n];
+		QByteArray record;
+		if(valid) {
+			if(d->binary) {
+				record = eventToRecord(e);
+			}
+			else {
+				QString line = eventToLine(e);
+				if(!line.isEmpty())
+					record = line.toUtf8() + '\n';
+			}
+		}
+		if(record.isEmpty()) {
+			results += qMakePair(d->pendingReqs[n], false);
+			continue;
+		}
+
+		offsets.append(end + data.size());
+		written += e;
+		data += record;
+		results += qMakePair(d->pendingReqs[n], true);
+	}
+
+	bool ok = true;
+	if(!data.isEmpty()) {
+		// the mapping doesn't cover the data we're about to write
+		unmap();
+
+		ok = f.seek(end) && f.write(data) == data.size();
+		f.flush();
+	}
+
+	if(!ok) {
+		for(int n = 0; n < results.count(); ++n)
+			results[n].second = false;
+	}
+	else if ( d->indexed && !offsets.isEmpty() ) {
+		int first = d->index.size();
+		d->index += offsets;
+		appendIndex(first);
+
+		if ( d->wordsIndexed && d->wordsCovered == first ) {
+			QList<QStringList> lists;
+			for(int n = 0; n < written.count(); ++n)
+				lists += addWords(first + n, written[n]);
+			d->wordsCovered = d->index.size();
+			appendWords(first, lists);
+		}
+	}
+
+	qDeleteAll(d->pendingEvents);
+	d->pendingEvents.clear();
+	d->pendingReqs.clear();
+	return results;
+}
+
+/**
+ * Returns true if \a e is a message whose body contains \a str.
+ */
+bool EDBFlatFile::File::matches(PsiEvent *e, const QString &str)
+{
+	if(e->type() != PsiEvent::Message)
 		return false;
 
-	QString line = eventToLine(e);
-	if(line.isEmpty())
+	MessageEvent *me = (MessageEvent *)e;
+	return me->message().body().find(str, 0, false) != -1;
+}
+
+/**
+ * Adds the words of \a e to the word index, and returns them.
+ */
+QStringList EDBFlatFile::File::addWords(int id, PsiEvent *e)
+{
+	QStringList words;
+	if(e->type() != PsiEvent::Message)
+		return words;
+
+	MessageEvent *me = (MessageEvent *)e;
+	words = edbWords(me->message().body()).toSet().toList();
+	foreach(QString word, words)
+		d->words[word].append(id);
+	return words;
+}
+
+bool EDBFlatFile::File::loadWordIndex()
+{
+	QFile file(wordIndexFileName(fname));
+	if (!file.open(QIODevice::ReadOnly))
+		return false;
+
+	QDataStream in(&file);
+	in.setVersion(QDataStream::Qt_4_2);
+	quint32 magic, version;
+	in >> magic >> version;
+	if (in.status() != QDataStream::Ok || magic != EDB_WORDS_MAGIC || version != EDB_WORDS_VERSION)
+		return false;
+
+	int id = 0;
+	while (!in.atEnd()) {
+		QStringList words;
+		in >> words;
+		if (in.status() != QDataStream::Ok)
+			break;
+		if (id >= d->index.size()) {
+			d->words.clear();
+			return false;
+		}
+		foreach(QString word, words)
+			d->words[word].append(id);
+		++id;
+	}
+
+	d->wordsCovered = id;
+	// a torn write at the end means the sidecar has to be rewritten
+	d->wordsOnDisk = in.atEnd() ? id : -1;
+	return true;
+}
+
+/**
+ * Rewrites the whole sidecar.  This is only needed when the word index
+ * was rebuilt, or the sidecar was damaged.
+ */
+void EDBFlatFile::File::saveWordIndex()
+{
+	QVector<QStringList> lists(d->wordsCovered);
+	EDBWordIndex::ConstIterator it = d->words.constBegin();
+	for (; it != d->words.constEnd(); ++it) {
+		foreach(int id, it.value())
+			lists[id] += it.key();
+	}
+
+	QFile file(wordIndexFileName(fname));
+	if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+		d->wordsOnDisk = -1;
+		return;
+	}
+
+	QDataStream out(&file);
+	out.setVersion(QDataStream::Qt_4_2);
+	out << (quint32)EDB_WORDS_MAGIC << (quint32)EDB_WORDS_VERSION;
+	for (int n = 0; n < lists.size(); ++n)
+		out << lists[n];
+	d->wordsOnDisk = d->wordsCovered;
+}
+
+/**
+ * Stores the words of the events starting at \a from in the sidecar.
+ */
+void EDBFlatFile::File::appendWords(int from, const QList<QStringList> &lists)
+{
+	if (lists.isEmpty())
+		return;
+	if (from != d->wordsOnDisk) {
+		saveWordIndex();
+		return;
+	}
+
+	QFile file(wordIndexFileName(fname));
+	if (!file.open(QIODevice::WriteOnly | QIODevice::Append)) {
+		d->wordsOnDisk = -1;
+		return;
+	}
+
+	QDataStream out(&file);
+	out.setVersion(QDataStream::Qt_4_2);
+	foreach(QStringList words, lists)
+		out << words;
+	d->wordsOnDisk = from + lists.count();
+}
+
+/**
+ * Loads the word index, and adds the events that aren't in it yet.  For
+ * logs written before the word index existed this indexes the whole file.
+ */
+void EDBFlatFile::File::ensureWordIndex()
+{
+	ensureIndex();
+	if (!d->indexed)
+		return;
+
+	if (!d->wordsIndexed) {
+		if (!loadWordIndex()) {
+			d->words.clear();
+			d->wordsCovered = 0;
+			d->wordsOnDisk = -1;
+		}
+		d->wordsIndexed = true;
+	}
+
+	int total = d->index.size();
+	if (d->wordsCovered < total) {
+		int from = d->wordsCovered;
+		QList<QStringList> lists;
+		for (int id = from; id < total; ++id) {
+			PsiEvent *e = eventAt(d->index[id]);
+			if (e) {
+				lists += addWords(id, e);
+				delete e;
+			}
+			else {
+				lists += QStringList();
+			}
+		}
+		d->wordsCovered = total;
+		appendWords(from, lists);
+	}
+	else if (d->wordsOnDisk != d->wordsCovered) {
+		saveWordIndex();
+	}
+}
+
+/**
+ * Merges the ascending id lists \a a and \a b into their intersection.
+ */
+static QVector<int> edbIntersect(const QVector<int> &a, const QVector<int> &b)
+{
+	QVector<int> result;
+	int i = 0, j = 0;
+	while (i < a.size() && j < b.size()) {
+		if (a[i] < b[j])
+			++i;
+		else if (b[j] < a[i])
+			++j;
+		else {
+			result.append(a[i]);
+			++i;
+			++j;
+		}
+	}
+	return result;
+}
+
+/**
+ * Fills \a candidates with the ascending ids of the events that might
+ * contain \a str, i.e. the ones having a matching word for each of its
+ * words.  A word surrounded by other characters in \a str has to match
+ * exactly.  The last word may continue in the message, so it matches the
+ * words it is a prefix of.  The first word may start in the middle of a
+ * word of the message, which can only be found by looking through the
+ * whole vocabulary.  Returns false if the word index can't be used for
+ * this search string, in which case all events have to be checked.
+ */
+bool EDBFlatFile::File::findCandidates(const QString &str, QVector<int> *candidates)
+{
+	touch();
+
+	QStringList words = edbWords(str);
+	if (words.isEmpty() || !valid)
 		return false;
 
-	f.seek(f.size());
-	quint64 at = f.pos();
+	ensureWordIndex();
+	if (!d->wordsIndexed)
+		return false;
 
-	QTextStream t;
-	t.setDevice(&f);
-	t.setEncoding(QTextStream::UnicodeUTF8);
-	t << line << endl;
-	f.flush();
+	bool firstOpen = str[0].isLetterOrNumber();
+	bool lastOpen = str[str.length() - 1].isLetterOrNumber();
+	QVector<int> result;
+	for (int n = 0; n < words.count(); ++n) {
+		const QString &word = words[n];
+		bool openStart = n == 0 && firstOpen;
+		bool openEnd = n == words.count() - 1 && lastOpen;
+
+		QVector<int> ids;
+		if (!openStart && !openEnd) {
+			ids = d->words.value(word);
+		}
+		else {
+			QSet<int> found;
+			EDBWordIndex::ConstIterator it;
+			if (!openStart) {
+				it = d->words.lowerBound(word);
+				for (; it != d->words.constEnd() && it.key().startsWith(word); ++it) {
+					foreach(int id, it.value())
+						found += id;
+				}
+			}
+			else {
+				for (it = d->words.constBegin(); it != d->words.constEnd(); ++it) {
+					if (openEnd ? it.key().contains(word) : it.key().endsWith(word)) {
+						foreach(int id, it.value())
+							found += id;
+					}
+				}
+			}
+			ids.reserve(found.size());
+			foreach(int id, found)
+				ids.append(id);
+			qSort(ids.begin(), ids.end());
+		}
 
-	if ( d->indexed ) {
-		int oldsize = d->index.size();
-		d->index.resize(oldsize+1);
-		d->index[oldsize] = at;
+		result = n == 0 ? ids : edbIntersect(result, ids);
+		if (result.isEmpty())
+			break;
 	}
 
+	*candidates = result;
 	return true;
 }
 
@@ -797,9 +1847,55 @@ PsiEvent *EDBFlatFile::File::lineToEvent(const QString &line)
 	// -- read end --
 
 	int type = sType.toInt();
+	bool originLocal = (sOrigin == "to") ? true: false;
+	QDateTime ts = QDateTime::fromString(sTime, Qt::ISODate);
+	if(type == 0 || type == 1 || type == 4 || type == 5) {
+		QString body;
+		if(sFlags[0] == 'N')
+			body = logdecode(sText);
+		else
+			body = logdecode(QString::fromUtf8(sText));
+		return makeEvent(type, originLocal, ts, logdecode(sSubj), logdecode(sUrl), logdecode(sUrlDesc), body);
+	}
+	return makeEvent(type, originLocal, ts, QString(), QString(), QString(), sText);
+}
+
+/**
+ * Decodes a binary record (without its length field).
+ */
+PsiEvent *EDBFlatFile::File::recordToEvent(const uchar *p, int len)
+{
+	if(len < EDB_RECORD_FIXED)
+		return 0;
+
+	int type = p[0];
+	bool originLocal = p[1] & EDB_RECORD_LOCAL;
+	qint64 time = (qint64)edbGet32(p + 2) | ((qint64)edbGet32(p + 6) << 32);
+	QDateTime ts;
+	if(time >= 0)
+		ts = QDateTime::fromTime_t((uint)time);
+
+	QString fields[4];
+	int at = EDB_RECORD_FIXED;
+	for(int n = 0; n < 4; ++n) {
+		if(at + 4 > len)
+			return 0;
+		quint32 size = edbGet32(p + at);
+		at += 4;
+		if(size > (quint32)(len - at))
+			return 0;
+		fields[n] = QString::fromUtf8((const char *)p + at, size);
+		at += size;
+	}
+
+	return makeEvent(type, originLocal, ts, fields[0], fields[1], fields[2], fields[3]);
+}
+
+PsiEvent *EDBFlatFile::File::makeEvent(int type, bool originLocal, const QDateTime &ts, const QString &subject, const QString &url, const QString &urlDesc, const QString &body)
+{
 	if(type == 0 || type == 1 || type == 4 || type == 5) {
 		Message m;
-		m.setTimeStamp(QDateTime::fromString(sTime, Qt::ISODate));
+		m.setTimeStamp(ts);
 		if(type == 1)
 			m.setType("chat");
 		else if(type == 4)
@@ -809,17 +1905,12 @@ PsiEvent *EDBFlatFile::File::lineToEvent(const QString &line)
 		else
 			m.setType("");
 
-		bool originLocal = (sOrigin == "to") ? true: false;
 		m.setFrom(j);
-		if(sFlags[0] == 'N')
-			m.setBody(logdecode(sText));
-		else
-			m.setBody(logdecode(QString::fromUtf8(sText)));
-		m.setSubject(logdecode(sSubj));
+		m.setBody(body);
+		m.setSubject(subject);
 
-		QString url = logdecode(sUrl);
 		if(!url.isEmpty())
-			m.urlAdd(Url(url, logdecode(sUrlDesc)));
+			m.urlAdd(Url(url, urlDesc));
 		m.setSpooled(true);
 
 		MessageEvent *me = new MessageEvent(m, 0);
@@ -832,9 +1923,9 @@ PsiEvent *EDBFlatFile::File::lineToEvent(const QString &line)
 		if(type == 2) {
 			// stupid "system message" from Psi <= 0.8.6
 			// try to figure out what kind it REALLY is based on the text
-			if(sText == tr("<big>[System Message]</big><br>You are now authorized."))
+			if(body == tr("<big>[System Message]</big><br>You are now authorized."))
 				subType = "subscribed";
-			else if(sText == tr("<big>[System Message]</big><br>Your authorization has been removed!"))
+			else if(body == tr("<big>[System Message]</big><br>Your authorization has been removed!"))
 				subType = "unsubscribed";
 		}
 		else if(type == 3)
@@ -847,13 +1938,157 @@ PsiEvent *EDBFlatFile::File::lineToEvent(const QString &line)
 			subType = "unsubscribed";
 
 		AuthEvent *ae = new AuthEvent(j, subType, 0);
-		ae->setTimeStamp(QDateTime::fromString(sTime, Qt::ISODate));
+		ae->setTimeStamp(ts);
 		return ae;
 	}
 
 	return NULL;
 }
 
+/**
+ * Encodes \a e as a binary record, including its length field.  Returns
+ * an empty array for events that can't be stored.
+ */
+QByteArray EDBFlatFile::File::eventToRecord(PsiEvent *e)
+{
+	int type;
+	QDateTime ts;
+	QString subject, url, urlDesc, body;
+
+	if(e->type() == PsiEvent::Message) {
+		MessageEvent *me = (MessageEvent *)e;
+		const Message &m = me->message();
+		const UrlList urls = m.urlList();
+
+		type = 0;
+		if(m.type() == "chat")
+			type = 1;
+		else if(m.type() == "error")
+			type = 4;
+		else if(m.type() == "headline")
+			type = 5;
+		ts = m.timeStamp();
+		subject = m.subject();
+		if(!urls.isEmpty()) {
+			url = urls.first().url();
+			urlDesc = urls.first().desc();
+		}
+		body = m.body();
+	}
+	else if(e->type() == PsiEvent::Auth) {
+		AuthEvent *ae = (AuthEvent *)e;
+		QString subType = ae->authType();
+		type = 0;
+		if(subType == "subscribe")
+			type = 3;
+		else if(subType == "subscribed")
+			type = 6;
+		else if(subType == "unsubscribe")
+			type = 7;
+		else if(subType == "unsubscribed")
+			type = 8;
+		ts = ae->timeStamp();
+		body = subType;
+	}
+	else {
+		return QByteArray();
+	}
+
+	qint64 time = ts.isValid() ? (qint64)ts.toTime_t() : -1;
+
+	QByteArray record;
+	edbPut32(record, 0); // length, filled in below
+	record += char(type);
+	record += char(e->originLocal() ? EDB_RECORD_LOCAL : 0);
+	edbPut32(record, quint32(time));
+	edbPut32(record, quint32(time >> 32));
+	edbPutString(record, subject);
+	edbPutString(record, url);
+	edbPutString(record, urlDesc);
+	edbPutString(record, body);
+
+	quint32 len = record.size() - 4;
+	for(int n = 0; n < 4; ++n)
+		record[n] = char(len >> (8 * n));
+	return record;
+}
+
+/**
+ * Rewrites a file in the legacy text format in the binary format.  There
+ * must be no buffered appends.  The text file is kept as .old until the
+ * new one is in place.
+ */
+bool EDBFlatFile::File::convert()
+{
+	if(!valid || !d->pendingEvents.isEmpty())
+		return false;
+	if(d->binary)
+		return true;
+	if(f.size() == 0) {
+		// nothing to rewrite, the next append starts the binary file
+		d->binary = true;
+		return true;
+	}
+
+	ensureIndex();
+	if(!d->indexed)
+		return false;
+
+	QString newName = fname + ".new";
+	QFile out(newName);
+	if(!out.open(QIODevice::WriteOnly | QIODevice::Truncate))
+		return false;
+
+	// stream the events over one at a time
+	QVector<quint64> index;
+	qint64 at = EDB_RECORD_HEADER;
+	bool ok = out.write(EDB_RECORD_MAGIC, EDB_RECORD_HEADER) == EDB_RECORD_HEADER;
+	for(int id = 0; ok && id < d->index.size(); ++id) {
+		PsiEvent *e = eventAt(d->index[id]);
+		QByteArray record = e ? eventToRecord(e) : QByteArray();
+		delete e;
+		if(record.isEmpty()) {
+			// keep the event ids intact
+			ok = false;
+			break;
+		}
+
+		index.append(at);
+		ok = out.write(record) == record.size();
+		at += record.size();
+	}
+	out.close();
+
+	if(!ok) {
+		qWarning("EDBFlatFile::File::convert(): Unable to convert %s.", qPrintable(fname));
+		QFile::remove(newName);
+		return false;
+	}
+
+	// swap the files, keeping the old one until the new one is in place
+	unmap();
+	f.close();
+	QString oldName = fname + ".old";
+	QFile::remove(oldName);
+	if(!QFile::rename(fname, oldName)) {
+		QFile::remove(newName);
+		valid = f.open(QIODevice::ReadWrite);
+		return false;
+	}
+	if(!QFile::rename(newName, fname)) {
+		QFile::rename(oldName, fname);
+		valid = f.open(QIODevice::ReadWrite);
+		return false;
+	}
+	QFile::remove(oldName);
+
+	valid = f.open(QIODevice::ReadWrite);
+	d->binary = true;
+	d->index = index;
+	saveIndex();
+	return valid;
+}
+
 QString EDBFlatFile::File::eventToLine(PsiEvent *e)
 {
 	int subflags = 0;
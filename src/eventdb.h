@@ -22,13 +22,19 @@
 #define EVENTDB_H
 
 #include <qobject.h>
-#include <qtimer.h>
 #include <qfile.h>
+#include <QTime>
 #include <q3ptrlist.h>
+#include <QList>
+#include <QPair>
+#include <QVector>
+#include <QStringList>
 
 #include "xmpp_jid.h"
 
 class PsiEvent;
+class QDateTime;
+struct item_file_req;
 
 class EDBItem
 {
@@ -57,7 +63,7 @@ class EDBHandle : public QObject
 {
 	Q_OBJECT
 public:
-	enum { Read, Write, Erase };
+	enum { Read, Write, Erase, Convert };
 	EDBHandle(EDB *);
 	~EDBHandle();
 
@@ -66,8 +72,10 @@ public:
 	void getOldest(const XMPP::Jid &, int len);
 	void get(const XMPP::Jid &jid, const QString &id, int direction, int len);
 	void find(const QString &, const XMPP::Jid &, const QString &id, int direction);
+	void findAll(const QString &, const XMPP::Jid &);
 	void append(const XMPP::Jid &, PsiEvent *);
 	void erase(const XMPP::Jid &);
+	void convert(const XMPP::Jid &);
 
 	bool busy() const;
 	const EDBResult *result() const;
@@ -95,6 +103,8 @@ public:
 	EDB();
 	virtual ~EDB()=0;
 
+	virtual void flush();
+
 protected:
 	int genUniqueId() const;
 	virtual int getLatest(const XMPP::Jid &, int len)=0;
@@ -102,7 +112,9 @@ protected:
 	virtual int get(const XMPP::Jid &jid, const QString &id, int direction, int len)=0;
 	virtual int append(const XMPP::Jid &, PsiEvent *)=0;
 	virtual int find(const QString &, const XMPP::Jid &, const QString &id, int direction)=0;
+	virtual int findAll(const QString &, const XMPP::Jid &)=0;
 	virtual int erase(const XMPP::Jid &)=0;
+	virtual int convert(const XMPP::Jid &)=0;
 	void resultReady(int, EDBResult *);
 	void writeFinished(int, bool);
 
@@ -118,8 +130,10 @@ private:
 	int op_getOldest(const XMPP::Jid &, int len);
 	int op_get(const XMPP::Jid &, const QString &id, int direction, int len);
 	int op_find(const QString &, const XMPP::Jid &, const QString &id, int direction);
+	int op_findAll(const QString &, const XMPP::Jid &);
 	int op_append(const XMPP::Jid &, PsiEvent *);
 	int op_erase(const XMPP::Jid &);
+	int op_convert(const XMPP::Jid &);
 };
 
 class EDBFlatFile : public EDB
@@ -133,19 +147,33 @@ public:
 	int getOldest(const XMPP::Jid &, int len);
 	int get(const XMPP::Jid &jid, const QString &id, int direction, int len);
 	int find(const QString &, const XMPP::Jid &, const QString &id, int direction);
+	int findAll(const QString &, const XMPP::Jid &);
 	int append(const XMPP::Jid &, PsiEvent *);
 	int erase(const XMPP::Jid &);
+	void flush();
+
+	void setBinaryFormat(bool);
+	int convert(const XMPP::Jid &);
 
 	class File;
 
-private slots:
-	void performRequests();
-	void file_timeout();
+protected:
+	bool event(QEvent *);
 
 private:
 	class Private;
 	Private *d;
-
+	class Thread;
+	friend class Thread;
+
+	void queueRequest(item_file_req *);
+	void performRequests(const QList<item_file_req*> &);
+	void performRequest(item_file_req *);
+	void commitFile(File *);
+	void commitAppends(bool all);
+	bool hasPendingAppends() const;
+	void closeIdleFiles();
+	EDBItem *makeItem(File *, PsiEvent *, int id) const;
 	File *findFile(const XMPP::Jid &) const;
 	File *ensureFile(const XMPP::Jid &);
 	bool deleteFile(const XMPP::Jid &);
@@ -155,28 +183,31 @@ class EDBFlatFile::File : public QObject
 {
 	Q_OBJECT
 public:
-	File(const XMPP::Jid &_j);
+	File(const XMPP::Jid &_j, bool binary = false);
 	~File();
 
 	int total() const;
 	void touch();
+	bool idle() const;
 	PsiEvent *get(int);
-	bool append(PsiEvent *);
+	void queueAppend(int req, PsiEvent *);
+	int pendingCount() const;
+	bool pendingDue() const;
+	QList< QPair<int, bool> > commit();
+	bool convert();
+	bool findCandidates(const QString &, QVector<int> *);
 
 	static QString jidToFileName(const XMPP::Jid &);
-
-signals:
-	void timeout();
-
-private slots:
-	void timer_timeout();
+	static QString indexFileName(const QString &historyFileName);
+	static QString wordIndexFileName(const QString &historyFileName);
+	static bool matches(PsiEvent *, const QString &);
 
 public:
 	XMPP::Jid j;
 	QString fname;
 	QFile f;
 	bool valid;
-	QTimer *t;
+	QTime lastAccess;
 
 	class Private;
 	Private *d;
@@ -184,7 +215,25 @@ public:
 private:
 	PsiEvent *lineToEvent(const QString &);
 	QString eventToLine(PsiEvent *);
+	PsiEvent *recordToEvent(const uchar *, int len);
+	QByteArray eventToRecord(PsiEvent *);
+	PsiEvent *makeEvent(int type, bool originLocal, const QDateTime &, const QString &subject, const QString &url, const QString &urlDesc, const QString &body);
+	PsiEvent *eventAt(quint64 at);
+	qint64 firstOffset() const;
+	qint64 recordEnd(qint64 at);
 	void ensureIndex();
+	bool loadIndex();
+	void scanIndex(qint64 from);
+	void saveIndex();
+	void appendIndex(int from);
+	QString readLine(quint64 at);
+	void ensureWordIndex();
+	bool loadWordIndex();
+	void saveWordIndex();
+	void appendWords(int from, const QList<QStringList> &);
+	QStringList addWords(int id, PsiEvent *);
+	uchar *ensureMap();
+	void unmap();
 };
 
 #endif
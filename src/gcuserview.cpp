@@ -129,6 +129,7 @@ int GCUserViewGroupItem::compare(Q3ListViewItem *i, int col, bool ascending) con
 GCUserView::GCUserView(QWidget* parent)
 	: Q3ListView(parent)
 	, gcDlg_(0)
+	, batch_(0)
 {
 	setResizeMode(Q3ListView::AllColumns);
 	setTreeStepSize(0);
@@ -136,13 +137,12 @@ GCUserView::GCUserView(QWidget* parent)
 	header()->hide();
 	addColumn("");
 	setSortColumn(0);
-	Q3ListViewItem* i;
-	i = new GCUserViewGroupItem(this, tr("Visitors"), 3);
-	i->setOpen(true);
-	i = new GCUserViewGroupItem(this, tr("Participants"), 2);
-	i->setOpen(true);
-	i = new GCUserViewGroupItem(this, tr("Moderators"), 1);
-	i->setOpen(true);
+	groups_[Visitor] = new GCUserViewGroupItem(this, tr("Visitors"), 3);
+	groups_[Visitor]->setOpen(true);
+	groups_[Participant] = new GCUserViewGroupItem(this, tr("Participants"), 2);
+	groups_[Participant]->setOpen(true);
+	groups_[Moderator] = new GCUserViewGroupItem(this, tr("Moderators"), 1);
+	groups_[Moderator]->setOpen(true);
 
 	connect(this, SIGNAL(doubleClicked(Q3ListViewItem *)), SLOT(qlv_doubleClicked(Q3ListViewItem *)));
 	connect(this, SIGNAL(contextMenuRequested(Q3ListViewItem *, const QPoint &, int)), SLOT(qlv_contextMenuRequested(Q3ListViewItem *, const QPoint &, int)));
@@ -171,10 +171,9 @@ Q3DragObject* GCUserView::dragObject()
 
 void GCUserView::clear()
 {
-	for (Q3ListViewItem *j = firstChild(); j; j = j->nextSibling())
-		while (GCUserViewItem* i = (GCUserViewItem*) j->firstChild()) {
-			delete i;
-		}
+	qDeleteAll(nickIndex_);
+	nickIndex_.clear();
+	jidIndex_.clear();
 }
 
 void GCUserView::updateAll()
@@ -186,50 +185,51 @@ void GCUserView::updateAll()
 
 QStringList GCUserView::nickList() const
 {
-	QStringList list;
-
-	for (Q3ListViewItem *j = firstChild(); j; j = j->nextSibling())
-		for(Q3ListViewItem *lvi = j->firstChild(); lvi; lvi = lvi->nextSibling())
-			list << lvi->text(0);
-
+	QStringList list = nickIndex_.keys();
 	qSort(list.begin(), list.end(), caseInsensitiveLessThan);
 	return list;
 }
 
 bool GCUserView::hasJid(const Jid& jid)
 {
-	for (Q3ListViewItem *j = firstChild(); j; j = j->nextSibling())
-		for(GCUserViewItem *lvi = (GCUserViewItem*) j->firstChild(); lvi; lvi = (GCUserViewItem*) lvi->nextSibling()) {
-			if(!lvi->s.mucItem().jid().isEmpty() && lvi->s.mucItem().jid().compare(jid,false))
-				return true;
-		}
-	return false;
+	return jidIndex_.contains(jid.bare());
 }
 
 Q3ListViewItem *GCUserView::findEntry(const QString &nick)
 {
-	for (Q3ListViewItem *j = firstChild(); j; j = j->nextSibling())
-		for(Q3ListViewItem *lvi = j->firstChild(); lvi; lvi = lvi->nextSibling()) {
-			if(lvi->text(0) == nick)
-				return lvi;
-		}
-	return 0;
+	return nickIndex_.value(nick);
+}
+
+void GCUserView::indexJid(GCUserViewItem *lvi, bool add)
+{
+	const Jid &jid = lvi->s.mucItem().jid();
+	if (jid.isEmpty())
+		return;
+	if (add)
+		jidIndex_.insert(jid.bare(), lvi);
+	else
+		jidIndex_.remove(jid.bare(), lvi);
 }
 
 void GCUserView::updateEntry(const QString &nick, const Status &s)
 {
-	GCUserViewItem *lvi = (GCUserViewItem *)findEntry(nick);
-	if (lvi && lvi->s.mucItem().role() != s.mucItem().role()) {
-		delete lvi;
-		lvi = NULL;
+	GCUserViewItem *lvi = nickIndex_.value(nick);
+	if (lvi) {
+		indexJid(lvi, false);
+		if (lvi->s.mucItem().role() != s.mucItem().role()) {
+			// move to the group of the new role
+			lvi->parent()->takeItem(lvi);
+			findGroup(s.mucItem().role())->insertItem(lvi);
+		}
 	}
-
-	if(!lvi) {
+	else {
 		lvi = new GCUserViewItem(findGroup(s.mucItem().role()));
 		lvi->setText(0, nick);
+		nickIndex_.insert(nick, lvi);
 	}
 
 	lvi->s = s;
+	indexJid(lvi, true);
 	lvi->setPixmap(0, PsiIconset::instance()->status(lvi->s).impix());
 }
 
@@ -241,21 +241,38 @@ GCUserViewGroupItem* GCUserView::findGroup(MUCItem::Role a) const
 	else if (a == MUCItem::Participant)
 		r = Participant;
 
-	int i = 0;
-	for (Q3ListViewItem *j = firstChild(); j; j = j->nextSibling()) {
-		if (i == (int) r)
-			return (GCUserViewGroupItem*) j;
-		i++;
-	}
-
-	return NULL;
+	return groups_[r];
 }
 
 void GCUserView::removeEntry(const QString &nick)
 {
-	Q3ListViewItem *lvi = findEntry(nick);
-	if(lvi)
+	GCUserViewItem *lvi = nickIndex_.take(nick);
+	if(lvi) {
+		indexJid(lvi, false);
 		delete lvi;
+	}
+}
+
+/**
+ * Starts a series of updates.  Sorting and repainting are held back
+ * until the matching endBatch().
+ */
+void GCUserView::beginBatch()
+{
+	if (batch_++ == 0) {
+		setUpdatesEnabled(false);
+		setSortColumn(-1);
+	}
+}
+
+void GCUserView::endBatch()
+{
+	if (--batch_ == 0) {
+		setSortColumn(0);
+		sort();
+		setUpdatesEnabled(true);
+		triggerUpdate();
+	}
 }
 
 bool GCUserView::maybeTip(const QPoint &pos)
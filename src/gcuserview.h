@@ -22,6 +22,7 @@
 #define GCUSERVIEW_H
 
 #include <Q3ListView>
+#include <QHash>
 
 #include "xmpp_status.h"
 
@@ -74,6 +75,9 @@ public:
 	void removeEntry(const QString &);
 	QStringList nickList() const;
 
+	void beginBatch();
+	void endBatch();
+
 protected:
 	enum Role { Moderator = 0, Participant = 1, Visitor = 2 };
 
@@ -89,7 +93,13 @@ private slots:
 	void qlv_contextMenuRequested(Q3ListViewItem *, const QPoint &, int);
 
 private:
+	void indexJid(GCUserViewItem *, bool add);
+
 	GCMainDlg* gcDlg_;
+	GCUserViewGroupItem* groups_[3];
+	QHash<QString, GCUserViewItem*> nickIndex_;
+	QMultiHash<QString, GCUserViewItem*> jidIndex_; // real bare jid
+	int batch_;
 };
 
 #endif
@@ -48,6 +48,7 @@
 #include <QHBoxLayout>
 #include <QFrame>
 #include <QList>
+#include <QPair>
 #include <QVBoxLayout>
 #include <QContextMenuEvent>
 #include <QTextCursor>
@@ -96,6 +97,15 @@ public:
 		
 		trackBar = false;
 		oldTrackBarPosition = 0;
+		joinBurst = false;
+
+		PsiOptions *o = PsiOptions::instance();
+		optUseHighlighting = o->handle("options.ui.muc.use-highlighting");
+		optUseNickColoring = o->handle("options.ui.muc.use-nick-coloring");
+		optNickColors = o->handle("options.ui.look.colors.muc.nick-colors");
+		optUseEmoticons = o->handle("options.ui.emoticons.use-emoticons");
+		optLegacyFormatting = o->handle("options.ui.chat.legacy-formatting");
+		optChatSaysStyle = o->handle("options.ui.chat.use-chat-says-style");
 	}
 
 	GCMainDlg *dlg;
@@ -120,6 +130,17 @@ public:
 	QString lastSearch;
 
 	QPointer<MUCConfigDlg> configDlg;
+
+	// occupant presences that arrive right after joining are applied to
+	// the user list together, once the room goes quiet or our own
+	// presence arrives
+	bool joinBurst;
+	QList<QPair<QString, Status> > burst;
+	QTimer *burstTimer;
+
+	// options read for every message
+	OptionHandle optUseHighlighting, optUseNickColoring, optNickColors;
+	OptionHandle optUseEmoticons, optLegacyFormatting, optChatSaysStyle;
 	
 public:
 	bool trackBar;
@@ -156,6 +177,11 @@ public slots:
 		te_log()->scrollToBottom();
 	}
 
+	void logTextRemoved(int length) {
+		// the trackbar moves up with the log, or goes away with its top
+		oldTrackBarPosition = qMax(0, oldTrackBarPosition - length);
+	}
+
 protected slots:
 	void slotScroll() {
 		te_log()->scrollToBottom();
@@ -468,6 +494,10 @@ GCMainDlg::GCMainDlg(PsiAccount *pa, const Jid &j, TabManager *tabManager)
 	d->pending = 0;
 	d->connecting = false;
 
+	d->burstTimer = new QTimer(this);
+	d->burstTimer->setSingleShot(true);
+	connect(d->burstTimer, SIGNAL(timeout()), SLOT(flushPresenceBurst()));
+
 	d->histAt = 0;
 	d->findDlg = 0;
 	d->configDlg = 0;
@@ -499,6 +529,7 @@ GCMainDlg::GCMainDlg(PsiAccount *pa, const Jid &j, TabManager *tabManager)
 #ifdef Q_WS_MAC
 	connect(ui_.log, SIGNAL(selectionChanged()), SLOT(logSelectionChanged()));
 #endif
+	connect(ui_.log, SIGNAL(textRemoved(int)), d, SLOT(logTextRemoved(int)));
 
 	ui_.lv_users->setMainDlg(this);
 	connect(ui_.lv_users, SIGNAL(action(const QString &, const Status &, int)), SLOT(lv_action(const QString &, const Status &, int)));
@@ -702,6 +733,22 @@ void GCMainDlg::unsetConnecting()
 	d->connecting = false;
 }
 
+void GCMainDlg::flushPresenceBurst()
+{
+	d->joinBurst = false;
+	d->burstTimer->stop();
+	if (d->burst.isEmpty())
+		return;
+
+	QList<QPair<QString, Status> > burst = d->burst;
+	d->burst.clear();
+
+	ui_.lv_users->beginBatch();
+	for (int i = 0; i < burst.count(); ++i)
+		presence(burst[i].first, burst[i].second);
+	ui_.lv_users->endBatch();
+}
+
 void GCMainDlg::action_error(MUCManager::Action, int, const QString& err) 
 {
 	appendSysMsg(err, false);
@@ -914,6 +961,15 @@ void GCMainDlg::error(int, const QString &str)
 
 void GCMainDlg::presence(const QString &nick, const Status &s)
 {
+	if (d->joinBurst) {
+		if (nick != d->self && !s.hasError()) {
+			d->burst += qMakePair(nick, s);
+			d->burstTimer->start(250);
+			return;
+		}
+		flushPresenceBurst();
+	}
+
 	if(s.hasError()) {
 		QString message;
 		if (s.errorCode() == 409) {
@@ -1156,7 +1212,7 @@ void GCMainDlg::message(const Message &_m)
 	if (m.body().left(d->self.length()) == d->self)
 		d->lastReferrer = m.from().resource();
 
-	if(PsiOptions::instance()->getOption("options.ui.muc.use-highlighting").toBool()) {
+	if(d->optUseHighlighting.toBool()) {
 		QStringList highlightWords = PsiOptions::instance()->getOption("options.ui.muc.highlight-words").toStringList();
 		foreach (QString word, highlightWords) {
 			if(m.body().contains((word), Qt::CaseInsensitive)) {
@@ -1185,6 +1241,8 @@ void GCMainDlg::joined()
 {
 	if(d->state == Private::Connecting) {
 		ui_.lv_users->clear();
+		d->burst.clear();
+		d->joinBurst = true;
 		d->state = Private::Connected;
 		ui_.pb_topic->setEnabled(true);
 		ui_.mle->chatEdit()->setEnabled(true);
@@ -1247,9 +1305,12 @@ QString GCMainDlg::getNickColor(QString nick)
 		sender=nicks[nick];
 	}
 	
-	QStringList nickColors = PsiOptions::instance()->getOption("options.ui.look.colors.muc.nick-colors").toStringList();
-	
-	if(!PsiOptions::instance()->getOption("options.ui.muc.use-nick-coloring").toBool() || nickColors.empty()) {
+	if(!d->optUseNickColoring.toBool()) {
+		return "#000000";
+	}
+
+	QStringList nickColors = d->optNickColors.toStringList();
+	if(nickColors.empty()) {
 		return "#000000";
 	}
 	else if(sender == -1 || nickColors.size() == 1) {
@@ -1265,7 +1326,7 @@ void GCMainDlg::appendMessage(const Message &m, bool alert)
 {
 	updateLastMsgTime(m.timeStamp());
 	//QString who, color;
-	if (!PsiOptions::instance()->getOption("options.ui.muc.use-highlighting").toBool())
+	if (!d->optUseHighlighting.toBool())
 		alert=false;
 	QString who, textcolor, nickcolor,alerttagso,alerttagsc;
 
@@ -1294,25 +1355,14 @@ void GCMainDlg::appendMessage(const Message &m, bool alert)
 	if(m.body().left(4) == "/me ")
 		emote = true;
 
-	QString txt;
-	if(emote)
-		txt = TextUtil::plain2rich(m.body().mid(4));
-	else
-		txt = TextUtil::plain2rich(m.body());
-
-	txt = TextUtil::linkify(txt);
-
-	if(PsiOptions::instance()->getOption("options.ui.emoticons.use-emoticons").toBool())
-		txt = TextUtil::emoticonify(txt);
-	if( PsiOptions::instance()->getOption("options.ui.chat.legacy-formatting").toBool() )
-		txt = TextUtil::legacyFormat(txt);
+	QString txt = TextUtil::formatMessage(emote ? m.body().mid(4) : m.body(), d->optUseEmoticons.toBool(), d->optLegacyFormatting.toBool());
 
 	if(emote) {
 		//ui_.log->append(QString("<font color=\"%1\">").arg(color) + QString("[%1]").arg(timestr) + QString(" *%1 ").arg(Qt::escape(who)) + txt + "</font>");
 		ui_.log->appendText(QString("<font color=\"%1\">").arg(nickcolor) + QString("[%1]").arg(timestr) + QString(" *%1 ").arg(Qt::escape(who)) + alerttagso + txt + alerttagsc + "</font>");
 	}
 	else {
-		if(PsiOptions::instance()->getOption("options.ui.chat.use-chat-says-style").toBool()) {
+		if(d->optChatSaysStyle.toBool()) {
 			//ui_.log->append(QString("<font color=\"%1\">").arg(color) + QString("[%1] ").arg(timestr) + QString("%1 says:").arg(Qt::escape(who)) + "</font><br>" + txt);
 			ui_.log->appendText(QString("<font color=\"%1\">").arg(nickcolor) + QString("[%1] ").arg(timestr) + QString("%1 says:").arg(Qt::escape(who)) + "</font><br>" + QString("<font color=\"%1\">").arg(textcolor) + alerttagso + txt + alerttagsc + "</font>");
 		}
@@ -1376,6 +1426,7 @@ void GCMainDlg::setLooks()
 	f.fromString(PsiOptions::instance()->getOption("options.ui.look.font.chat").toString());
 	ui_.log->setFont(f);
 	ui_.mle->chatEdit()->setFont(f);
+	ui_.log->setScrollbackLimit(PsiOptions::instance()->getOption("options.ui.chat.scrollback-limit").toInt());
 
 	f.fromString(PsiOptions::instance()->getOption("options.ui.look.font.contactlist").toString());
 	ui_.lv_users->Q3ListView::setFont(f);
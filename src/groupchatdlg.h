@@ -120,6 +120,7 @@ private slots:
 	void logSelectionChanged();
 	void setConnecting();
 	void unsetConnecting();
+	void flushPresenceBurst();
 	void action_error(MUCManager::Action, int, const QString&);
 	void updateIdentityVisibility();
 #ifdef WHITEBOARDING
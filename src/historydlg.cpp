@@ -124,6 +124,11 @@ public:
 	QString id_prev, id_begin, id_end, id_next;
 	int reqtype;
 	QString findStr;
+	QString findFrom;
+
+	// ids of all events matching findHitsStr, ascending
+	QList<int> findHits;
+	QString findHitsStr;
 
 	EDBHandle *h, *exp;
 };
@@ -203,6 +208,12 @@ HistoryDlg::HistoryDlg(const Jid &jid, PsiAccount *pa)
 	QPushButton *pb_erase = new QPushButton(tr("Er&ase All"), this);
 	connect(pb_erase, SIGNAL(clicked()), SLOT(doErase()));
 	vb3->addWidget(pb_erase);
+	if (PsiOptions::instance()->getOption("options.history.binary-format").toBool()) {
+		QPushButton *pb_convert = new QPushButton(tr("Con&vert"), this);
+		pb_convert->setToolTip(tr("Rewrite the history of this contact in the compact format"));
+		connect(pb_convert, SIGNAL(clicked()), SLOT(doConvert()));
+		vb3->addWidget(pb_convert);
+	}
 
 	sep = new QFrame(this);
 	sep->setFrameShape(QFrame::VLine);
@@ -311,10 +322,20 @@ void HistoryDlg::doErase()
 	}
 }
 
+void HistoryDlg::doConvert()
+{
+	int x = QMessageBox::information(this, tr("Confirm conversion"), tr("Older versions of Psi won't be able to read the message history for this contact anymore.\nAre you sure you want to do this?"), tr("&Yes"), tr("&No"), QString::null, 1);
+	if (x == 0) {
+		d->h->convert(d->jid);
+	}
+}
+
 void HistoryDlg::loadPage(int type)
 {
 	d->reqtype = type;
 	if(type == 0) {
+		// there may be new events, so the search results are stale now
+		d->findHitsStr = QString();
 		d->pb_refresh->setEnabled(false);
 		d->h->getLatest(d->jid, 50);
 		//printf("EDB: requesting latest 50 events\n");
@@ -413,9 +434,22 @@ void HistoryDlg::edb_finished()
 				//printf("EDB: requesting 50 events backward, starting at %s\n", d->id_prev.latin1());
 				return;
 			}
+			else if(d->reqtype == 4) {
+				// events are in forward order
+				d->findHits.clear();
+				for(EDBItem *i; (i = it.current()); ++it)
+					d->findHits += i->id().toInt();
+				d->findHitsStr = d->findStr;
+				jumpToHit(d->findFrom.toInt());
+				return;
+			}
 		}
 		else {
-			if(d->reqtype == 3) {
+			if(d->reqtype == 4) {
+				d->findHits.clear();
+				d->findHitsStr = d->findStr;
+			}
+			if(d->reqtype == 3 || d->reqtype == 4) {
 				QMessageBox::information(this, tr("Find"), tr("Search string '%1' not found.").arg(d->findStr));
 				return;
 			}
@@ -423,6 +457,7 @@ void HistoryDlg::edb_finished()
 	}
 	else if (d->h->lastRequestType() == EDBHandle::Erase) {
 		if (d->h->writeSuccess()) {
+			d->findHitsStr = QString();
 			d->lv->clear();
 			d->id_prev = "";
 			d->id_begin = "";
@@ -433,6 +468,11 @@ void HistoryDlg::edb_finished()
 			QMessageBox::critical(this, tr("Error"), tr("Unable to delete history file."));
 		}
 	}
+	else if (d->h->lastRequestType() == EDBHandle::Convert) {
+		if (!d->h->writeSuccess()) {
+			QMessageBox::critical(this, tr("Error"), tr("Unable to convert history file."));
+		}
+	}
 	else {
 		//printf("EDB: error\n");
 	}
@@ -469,9 +509,32 @@ void HistoryDlg::doFind()
 	}
 
 	//printf("searching for: [%s], starting at id=[%s]\n", str.latin1(), id.latin1());
-	d->reqtype = 3;
 	d->findStr = str;
-	d->h->find(str, d->jid, id, EDB::Backward);
+	if(d->findHitsStr == str) {
+		jumpToHit(id.toInt());
+		return;
+	}
+
+	// fetch all the matches at once, so that searching again is instant
+	d->reqtype = 4;
+	d->findFrom = id;
+	d->h->findAll(str, d->jid);
+}
+
+/**
+ * Shows the page ending with the last match at or before event \a from.
+ */
+void HistoryDlg::jumpToHit(int from)
+{
+	QList<int>::ConstIterator it = qUpperBound(d->findHits.constBegin(), d->findHits.constEnd(), from);
+	if(it == d->findHits.constBegin()) {
+		QMessageBox::information(this, tr("Find"), tr("Search string '%1' not found.").arg(d->findStr));
+		return;
+	}
+	--it;
+
+	d->reqtype = 1;
+	d->h->get(d->jid, QString::number(*it), EDB::Backward, 50);
 }
 
 void HistoryDlg::exportHistory(const QString &fname)
@@ -101,6 +101,7 @@ private slots:
 	void doNext();
 	void doSave();
 	void doErase();
+	void doConvert();
 	void setButtons();
 	void actionOpenEvent(PsiEvent *);
 	void doFind();
@@ -113,6 +114,7 @@ private:
 	Private *d;
 
 	void loadPage(int);
+	void jumpToHit(int);
 	void displayResult(const EDBResult *, int, int max=-1);
 	void exportHistory(const QString &fname);
 };
@@ -30,7 +30,9 @@
 #include <QMenu>
 #include <QResizeEvent>
 #include <QScrollBar>
+#include <QTextBlock>
 #include <QTextCharFormat>
+#include <QTextCursor>
 #include <QTextDocument>
 #include <QTimer>
 #include <QDateTime>
@@ -46,6 +48,7 @@
 ChatView::ChatView(QWidget *parent)
 	: PsiTextView(parent)
 	, dialog_(0)
+	, scrollbackLimit_(0)
 {
 	setWordWrapMode(QTextOption::WrapAtWordBoundaryOrAnywhere);
 
@@ -142,8 +145,64 @@ bool ChatView::handleCopyEvent(QObject *object, QEvent *event, ChatEdit *chatEdi
 	return false;
 }
 
+/**
+ * Limits the log to the \a blocks most recent paragraphs (usually one per
+ * message).  Older ones are dropped as new text is appended.  0 means no
+ * limit.
+ */
+void ChatView::setScrollbackLimit(int blocks)
+{
+	scrollbackLimit_ = qMax(0, blocks);
+	trimScrollback(0);
+}
+
+int ChatView::scrollbackLimit() const
+{
+	return scrollbackLimit_;
+}
+
+/**
+ * Removes paragraphs from the top so that \a reserve more fit within the
+ * scrollback limit.  Only the removed paragraphs are touched, so this
+ * doesn't get slower as the log grows.
+ */
+void ChatView::trimScrollback(int reserve)
+{
+	if (!scrollbackLimit_)
+		return;
+
+	int excess = document()->blockCount() + reserve - scrollbackLimit_;
+	if (excess <= 0)
+		return;
+
+	QTextBlock keep = document()->begin();
+	int height = 0;
+	for (int i = 0; i < excess && keep.next().isValid(); ++i) {
+		height += int(document()->documentLayout()->blockBoundingRect(keep).height());
+		keep = keep.next();
+	}
+
+	int length = keep.position();
+	if (!length)
+		return;
+
+	// the text view's own cursor (and so the selection) follows the edit
+	QTextBlockFormat blockFormat = keep.blockFormat();
+	QTextCursor cursor(document());
+	cursor.beginEditBlock();
+	cursor.setPosition(length, QTextCursor::KeepAnchor);
+	cursor.removeSelectedText();
+	cursor.setBlockFormat(blockFormat);
+	cursor.endEditBlock();
+
+	verticalScrollBar()->setValue(verticalScrollBar()->value() - height);
+	emit textRemoved(length);
+}
+
 void ChatView::appendText(const QString &text)
 {
+	trimScrollback(1);
+
 	bool doScrollToBottom = atBottom();
 	
 	// prevent scrolling back to selected text when 
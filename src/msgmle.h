@@ -47,6 +47,9 @@ public:
 	void appendText(const QString &text);
 	bool handleCopyEvent(QObject *object, QEvent *event, ChatEdit *chatEdit);
 
+	void setScrollbackLimit(int blocks);
+	int scrollbackLimit() const;
+
 	QString formatTimeStamp(const QDateTime &time);
 
 protected:
@@ -54,11 +57,21 @@ protected:
 	bool focusNextPrevChild(bool next);
 	void keyPressEvent(QKeyEvent *);
 
+signals:
+	/**
+	 * Emitted after the oldest \a length characters of the log were
+	 * dropped to stay within the scrollback limit.
+	 */
+	void textRemoved(int length);
+
 protected slots:
 	void autoCopy();
 
 private:
+	void trimScrollback(int reserve);
+
 	QWidget* dialog_;
+	int scrollbackLimit_;
 };
 
 class ChatEdit : public QTextEdit
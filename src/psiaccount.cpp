@@ -34,10 +34,13 @@
 #include <qobject.h>
 #include <qmap.h>
 #include <qca.h>
+#include <qfile.h>
 #include <qfileinfo.h>
 #include <QPixmap>
 #include <QFrame>
 #include <QList>
+#include <QHash>
+#include <QMap>
 #include <QHostInfo>
 
 #include "psiaccount.h"
@@ -59,6 +62,7 @@
 #include "accountmanagedlg.h"
 #include "changepwdlg.h"
 #include "xmlconsole.h"
+#include "xmlringbuffer.h"
 #include "userlist.h"
 #include "psievent.h"
 #include "jidutil.h"
@@ -283,10 +287,13 @@ public:
 		, stream(0)
 		, tls(0)
 		, tlsHandler(0)
-		, xmlRingbuf(1000)
-		, xmlRingbufWrite(0)
+		, xmlRingbuf(512 * 1024, 32 * 1024, 256 * 1024)
 		, doPopups_(true)
 	{
+		PsiOptions *o = PsiOptions::instance();
+		optSuppressWhileAway = o->handle("options.ui.notifications.popup-dialogs.suppress-while-away");
+		optPopupOnline = o->handle("options.ui.notifications.passive-popups.status.online");
+		optPopupStatusChange = o->handle("options.ui.notifications.passive-popups.status.other-changes");
 	}
 
 	PsiContactList* contactList;
@@ -363,11 +370,25 @@ public:
 	QPointer<QCATLSHandler> tlsHandler;
 	bool usingSSL;
 
-	QVector<xmlRingElem> xmlRingbuf;
-	int xmlRingbufWrite;
+	XmlRingBuffer xmlRingbuf;
+
+	// Presence changes are applied to the contact list and dialogs in
+	// batches, so that a contact sending several presences in a row (or
+	// the whole roster coming online after login) costs a single update.
+	struct PendingPresenceUpdate {
+		Jid jid;
+		QMap<QString, bool> resources; // resource -> fromPresence
+		bool animate;
+	};
+	QHash<QString, PendingPresenceUpdate> pendingPresence;
+	QTimer *presenceTimer;
+	int presenceCoalesced;
 
 	QHostAddress localAddress;
 
+	// options read for every incoming presence
+	OptionHandle optSuppressWhileAway, optPopupOnline, optPopupStatusChange;
+
 	QString pathToProfileEvents()
 	{
 		return pathToProfile(activeProfile) + "/events-" + acc.name + ".xml";
@@ -385,7 +406,7 @@ public:
 		if (lastManualStatus_.isAvailable()) {
 			if (lastManualStatus_.type() == XMPP::Status::DND)
 				return true;
-			if ((lastManualStatus_.type() == XMPP::Status::Away || lastManualStatus_.type() == XMPP::Status::XA) && PsiOptions::instance()->getOption("options.ui.notifications.popup-dialogs.suppress-while-away").toBool()) {
+			if ((lastManualStatus_.type() == XMPP::Status::Away || lastManualStatus_.type() == XMPP::Status::XA) && optSuppressWhileAway.toBool()) {
 				return true;
 			}
 		}
@@ -394,20 +415,14 @@ public:
 	}
 
 public slots:
-	void queueChanged()
-	{
-		eventQueue->toFile(pathToProfileEvents());
-	}
-
 	void loadQueue()
 	{
 		bool soundEnabled = PsiOptions::instance()->getOption("options.ui.notifications.sounds.enable").toBool();
 		PsiOptions::instance()->setOption("options.ui.notifications.sounds.enable", false); // disable the sound and popups
 		doPopups_ = false;
 
-		QFileInfo fi( pathToProfileEvents() );
-		if ( fi.exists() )
-			eventQueue->fromFile(pathToProfileEvents());
+		eventQueue->setJournal(pathToProfileEvents());
+		eventQueue->fromFile(pathToProfileEvents());
 
 		PsiOptions::instance()->setOption("options.ui.notifications.sounds.enable", soundEnabled);
 		doPopups_ = true;
@@ -426,17 +441,11 @@ public slots:
 
 	void client_xmlIncoming(const QString &s)
 	{
-		xmlRingbuf[xmlRingbufWrite].type = RingXmlIn;
-		xmlRingbuf[xmlRingbufWrite].xml = s;
-		xmlRingbuf[xmlRingbufWrite].time = QDateTime::currentDateTime();
-		xmlRingbufWrite = (xmlRingbufWrite + 1) % xmlRingbuf.count();
+		xmlRingbuf.append(RingXmlIn, s);
 	}
 	void client_xmlOutgoing(const QString &s)
 	{
-		xmlRingbuf[xmlRingbufWrite].type = RingXmlOut;
-		xmlRingbuf[xmlRingbufWrite].xml = s;
-		xmlRingbuf[xmlRingbufWrite].time = QDateTime::currentDateTime();
-		xmlRingbufWrite = (xmlRingbufWrite + 1) % xmlRingbuf.count();
+		xmlRingbuf.append(RingXmlOut, s);
 	}
 	
 	void pm_proxyRemoved(QString proxykey)
@@ -482,19 +491,6 @@ private:
 	}
 
 public:
-	// implementation for QList<PsiAccount::xmlRingElem> PsiAccount::dumpRingbuf()
-	QList< xmlRingElem > dumpRingbuf()
-	{
-		xmlRingElem el;
-		QList< xmlRingElem > ret;
-		for(int i=0; i < xmlRingbuf.count(); i++) {
-			el = xmlRingbuf[(xmlRingbufWrite + 1 + i) % xmlRingbuf.count()];
-			if (!el.xml.isEmpty()) {
-				ret += el;
-			}
-		}
-		return ret;
-	}
 	QWidget* findDialog(const QMetaObject& mo, const Jid& jid, bool compareResource) const
 	{
 		foreach(item_dialog2* i, dialogList) {
@@ -605,6 +601,10 @@ PsiAccount::PsiAccount(const UserAccount &acc, PsiContactList *parent, CapsRegis
 	d->client = 0;
 	d->cp = 0;
 	d->userCounter = 0;
+	d->presenceCoalesced = 0;
+	d->presenceTimer = new QTimer(this);
+	d->presenceTimer->setSingleShot(true);
+	connect(d->presenceTimer, SIGNAL(timeout()), SLOT(processPresenceUpdates()));
 	d->avatarFactory = 0;
 	d->voiceCaller = 0;
 	d->blockTransportPopupList = new BlockTransportPopupList();
@@ -622,7 +622,6 @@ PsiAccount::PsiAccount(const UserAccount &acc, PsiContactList *parent, CapsRegis
 
 	d->eventQueue = new EventQueue(this);
 	connect(d->eventQueue, SIGNAL(queueChanged()), SIGNAL(queueChanged()));
-	connect(d->eventQueue, SIGNAL(queueChanged()), d, SLOT(queueChanged()));
 	connect(d->eventQueue, SIGNAL(eventFromXml(PsiEvent *)), SLOT(eventFromXml(PsiEvent *)));
 	d->userList.setAutoDelete(true);
 	d->self = UserListItem(true);
@@ -1074,6 +1073,7 @@ void PsiAccount::setUserAccount(const UserAccount &acc)
 			QDir dir = oldfi.dir();
 			dir.rename(oldfi.fileName(), newfi.fileName());
 		}
+		d->eventQueue->setJournal(newfi.filePath());
 	}
 
 	if(d->stream) {
@@ -1113,11 +1113,13 @@ void PsiAccount::setUserAccount(const UserAccount &acc)
 
 void PsiAccount::deleteQueueFile()
 {
+	d->eventQueue->setJournal(QString());
 	QFileInfo fi(d->pathToProfileEvents());
 	if(fi.exists()) {
 		QDir dir = fi.dir();
 		dir.remove(fi.fileName());
 	}
+	QFile::remove(fi.filePath() + ".journal");
 }
 
 const Jid & PsiAccount::jid() const
@@ -1159,6 +1161,7 @@ void PsiAccount::login()
 	v_isActive = true;
 	isDisconnecting = false;
 	notifyOnlineOk = false;
+	d->presenceCoalesced = 0;
 	rosterDone = false;
 	presenceSent = false;
 
@@ -1283,6 +1286,9 @@ void PsiAccount::disconnect()
 		d->client->close();
 		cleanupStream();
 
+		// don't leave the history of this session in the write buffer
+		d->psi->edb()->flush();
+
 		disconnected();
 	}
 }
@@ -1901,10 +1907,7 @@ void PsiAccount::client_resourceAvailable(const Jid &j, const Resource &r)
 			tryVerify(u, rp);
 
 		u->setPresenceError("");
-		cpUpdate(*u, r.name(), true);
-
-		if(doAnim && PsiOptions::instance()->getOption("options.ui.contactlist.use-status-change-animation").toBool())
-			d->cp->animateNick(u->jid());
+		queuePresenceUpdate(*u, r.name(), true, doAnim);
 	}
 
 	if(doSound)
@@ -1912,7 +1915,7 @@ void PsiAccount::client_resourceAvailable(const Jid &j, const Resource &r)
 
 #if !defined(Q_WS_MAC) || !defined(HAVE_GROWL)
 	// Do the popup test earlier (to avoid needless JID lookups)
-	if ((popupType == PopupOnline && PsiOptions::instance()->getOption("options.ui.notifications.passive-popups.status.online").toBool()) || (popupType == PopupStatusChange && PsiOptions::instance()->getOption("options.ui.notifications.passive-popups.status.other-changes").toBool()))
+	if ((popupType == PopupOnline && d->optPopupOnline.toBool()) || (popupType == PopupStatusChange && d->optPopupStatusChange.toBool()))
 #endif
 	if(notifyOnlineOk && doPopup && !d->blockTransportPopupList->find(j, popupType == PopupOnline) && !d->noPopup(IncomingStanza)) {
 		QString name;
@@ -1924,7 +1927,7 @@ void PsiAccount::client_resourceAvailable(const Jid &j, const Resource &r)
 		else if ( popupType == PopupStatusChange )
 			pt = PsiPopup::AlertStatusChange;
 
-		if ((popupType == PopupOnline && PsiOptions::instance()->getOption("options.ui.notifications.passive-popups.status.online").toBool()) || (popupType == PopupStatusChange && PsiOptions::instance()->getOption("options.ui.notifications.passive-popups.status.other-changes").toBool())) {
+		if ((popupType == PopupOnline && d->optPopupOnline.toBool()) || (popupType == PopupStatusChange && d->optPopupStatusChange.toBool())) {
 			PsiPopup *popup = new PsiPopup(pt, this);
 			popup->setData(j, r, u);
 		}
@@ -1945,7 +1948,7 @@ void PsiAccount::client_resourceAvailable(const Jid &j, const Resource &r)
 			UserResourceList::Iterator rit = u->userResourceList().find(j.resource());
 			if (rit != u->userResourceList().end()) {
 				(*rit).setClient(capsManager()->clientName(j),capsManager()->clientVersion(j),"");
-				cpUpdate(*u,(*rit).name());
+				queuePresenceUpdate(*u, (*rit).name(), false);
 			}
 		}
 	}
@@ -1998,7 +2001,7 @@ void PsiAccount::client_resourceUnavailable(const Jid &j, const Resource &r)
 		}
 
 		u->setPresenceError("");
-		cpUpdate(*u, r.name(), true);
+		queuePresenceUpdate(*u, r.name(), true);
 	}
 	if(doSound)
 		playSound(PsiOptions::instance()->getOption("options.ui.notifications.sounds.contact-offline").toString());
@@ -2750,8 +2753,12 @@ void PsiAccount::enableNotifyOnline()
 		QTimer::singleShot(15000, this, SLOT(enableNotifyOnline()));
 		d->userCounter = 0;
 	}
-	else
+	else {
 		notifyOnlineOk = true;
+
+		// the initial presence flood is over, leave a note for the XML console
+		d->xmlRingbuf.append(RingSysMsg, QString("<!-- initial presence settled, %1 presence updates coalesced -->").arg(coalescedPresenceUpdates()));
+	}
 }
 
 
@@ -2858,10 +2865,7 @@ QList<UserListItem*> PsiAccount::findRelevant(const Jid &j) const
 	if(j.compare(d->self.jid(), false))
 		list.append(&d->self);
 	else {
-		foreach(UserListItem* u, d->userList) {
-			if(!u->jid().compare(j, false))
-				continue;
-
+		foreach(UserListItem* u, d->userList.findBare(j)) {
 			if(!u->jid().resource().isEmpty()) {
 				if(u->jid().resource() != j.resource())
 					continue;
@@ -2918,6 +2922,71 @@ void PsiAccount::cpUpdate(const UserListItem &u, const QString &rname, bool from
 	d->psi->updateContactGlobal(this, j);
 }
 
+/**
+ * Schedules a cpUpdate() for \a u.  Updates for the same contact arriving
+ * within a short time (or while the initial presence flood after login
+ * lasts) are merged into one.
+ */
+void PsiAccount::queuePresenceUpdate(const UserListItem &u, const QString &rname, bool fromPresence, bool animate)
+{
+	QString key = u.jid().full();
+	QHash<QString, Private::PendingPresenceUpdate>::Iterator it = d->pendingPresence.find(key);
+	if(it == d->pendingPresence.end()) {
+		Private::PendingPresenceUpdate p;
+		p.jid = u.jid();
+		p.animate = false;
+		it = d->pendingPresence.insert(key, p);
+	}
+	else {
+		++d->presenceCoalesced;
+	}
+
+	Private::PendingPresenceUpdate &p = it.value();
+	p.resources[rname] = p.resources.value(rname) || fromPresence;
+	p.animate = p.animate || animate;
+
+	if(!d->presenceTimer->isActive())
+		d->presenceTimer->start(notifyOnlineOk ? 100 : 500);
+}
+
+void PsiAccount::processPresenceUpdates()
+{
+	QHash<QString, Private::PendingPresenceUpdate> pending = d->pendingPresence;
+	d->pendingPresence.clear();
+
+	bool animate = PsiOptions::instance()->getOption("options.ui.contactlist.use-status-change-animation").toBool();
+	foreach(Private::PendingPresenceUpdate p, pending) {
+		// the contact might have been removed in the meantime
+		UserListItem *u = find(p.jid);
+		if(!u)
+			continue;
+
+		// one full update, and the per-resource notifications for the rest
+		QMap<QString, bool>::ConstIterator it = p.resources.begin();
+		cpUpdate(*u, it.key(), it.value());
+		for(++it; it != p.resources.end(); ++it) {
+			Jid j = u->jid();
+			if(!it.key().isEmpty())
+				j.setResource(it.key());
+			updateContact(j);
+			updateContact(j, it.value());
+			d->psi->updateContactGlobal(this, j);
+		}
+
+		if(p.animate && animate)
+			d->cp->animateNick(u->jid());
+	}
+}
+
+/**
+ * Returns how many presence updates were merged into others since the
+ * last login.
+ */
+int PsiAccount::coalescedPresenceUpdates() const
+{
+	return d->presenceCoalesced;
+}
+
 EventDlg *PsiAccount::ensureEventDlg(const Jid &j)
 {
 	EventDlg *w = findDialog<EventDlg*>(j);
@@ -4913,13 +4982,12 @@ BookmarkManager* PsiAccount::bookmarkManager()
 }
 
 /**
- * \brief Returns the current contents of the debug ringbuffer.
- * it doesn't clear the ringbuffer
- * \return a QList<xmlRingElem> of the current debug buffer items.
+ * \brief Returns the debug ringbuffer with the recent XML traffic.
+ * Records are tagged with xmlRingType.
  */
-QList<PsiAccount::xmlRingElem> PsiAccount::dumpRingbuf()
+const XmlRingBuffer& PsiAccount::xmlRingbuf() const
 {
-	return d->dumpRingbuf();
+	return d->xmlRingbuf;
 }
 
 
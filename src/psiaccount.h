@@ -57,6 +57,7 @@ class PsiEvent;
 class PsiHttpAuthRequest;
 class Tune;
 class BookmarkManager;
+class XmlRingBuffer;
 class URLBookmark;
 class ConferenceBookmark;
 class VoiceCaller;
@@ -101,6 +102,7 @@ public:
 	bool isActive() const;
 	bool isConnected() const;
 	const QString &name() const;
+	int coalescedPresenceUpdates() const;
 
 	const UserAccount & userAccount() const;
 	void setUserAccount(const UserAccount &);
@@ -189,8 +191,7 @@ public:
 	BookmarkManager* bookmarkManager();
 
 	enum xmlRingType {RingXmlIn, RingXmlOut, RingSysMsg};
-	class xmlRingElem { public: int type; QDateTime time; QString xml; };
-	QList< xmlRingElem > dumpRingbuf();
+	const XmlRingBuffer& xmlRingbuf() const;
 
 signals:
 	void disconnected();
@@ -364,6 +365,7 @@ protected:
 
 private slots:
 	void eventFromXml(PsiEvent* e);
+	void processPresenceUpdates();
 
 private:
 	void handleEvent(PsiEvent* e, ActivationType activationType);
@@ -378,6 +380,7 @@ private:
 	void simulateContactOffline(UserListItem *);
 	void simulateRosterOffline();
 	void cpUpdate(const UserListItem &, const QString &rname="", bool fromPresence=false);
+	void queuePresenceUpdate(const UserListItem &, const QString &rname, bool fromPresence, bool animate=false);
 	void logEvent(const Jid &, PsiEvent *);
 	void queueEvent(PsiEvent* e, ActivationType activationType);
 	void openNextEvent(const UserListItem &, ActivationType activationType);
@@ -246,7 +246,7 @@ public:
 	QList<item_dialog*> dialogList;
 	int eventId;
 	QStringList recentNodeList; // FIXME move this to options system?
-	EDB *edb;
+	EDBFlatFile *edb;
 	S5BServer *s5bServer;
 	ProxyManager *proxy;
 	IconSelectPopup *iconSelect;
@@ -284,7 +284,7 @@ PsiCon::PsiCon()
 	d->actionList = 0;
 	d->defaultMenuBar = new QMenuBar(0);
 	d->capsRegistry = new CapsRegistry();
-	connect(d->capsRegistry, SIGNAL(registered(const CapsSpec&)), SLOT(saveCapabilities()));
+	d->capsRegistry->setFileName(ApplicationInfo::homeDir() + "/caps.xml");
 }
 
 PsiCon::~PsiCon()
@@ -397,6 +397,7 @@ bool PsiCon::init()
 	connect(d->proxy, SIGNAL(settingsChanged()), SLOT(proxy_settingsChanged()));
 	
 	connect(options, SIGNAL(optionChanged(const QString&)), SLOT(optionChanged(const QString&)));
+	d->edb->setBinaryFormat(options->getOption("options.history.binary-format").toBool());
 	
 	QDir profileDir( pathToProfile( activeProfile ) );
 	profileDir.rmdir( "info" ); // remove unused dir
@@ -896,8 +897,7 @@ void PsiCon::saveAccounts()
 
 void PsiCon::saveCapabilities()
 {
-	QFile file(ApplicationInfo::homeDir() + "/caps.xml");
-	d->capsRegistry->save(file);
+	d->capsRegistry->compact();
 }
 
 void PsiCon::updateMainwinStatus()
@@ -1067,6 +1067,10 @@ void PsiCon::optionChanged(const QString& option)
 	if (option == "options.p2p.bytestreams.listen-port") {
 		s5b_init();
 	}
+
+	if (option == "options.history.binary-format") {
+		d->edb->setBinaryFormat(PsiOptions::instance()->getOption(option).toBool());
+	}
 }
 
 void PsiCon::slotApplyOptions()
@@ -23,6 +23,9 @@
 #include <qdom.h>
 #include <QTextStream>
 #include <QList>
+#include <QFile>
+#include <QDataStream>
+#include <QMap>
 
 #include "psicon.h"
 #include "psiaccount.h"
@@ -643,14 +646,48 @@ PsiEvent* EventItem::event() const
 // EventQueue
 //----------------------------------------------------------------------------
 
+// The queue is persisted as an XML snapshot plus an append-only journal of
+// the changes made since.  The journal is folded back into the snapshot
+// every EVENTQUEUE_COMPACT_RECORDS records and when the queue is destroyed.
+#define EVENTQUEUE_COMPACT_RECORDS 200
+
+static const quint32 eventJournalMagic = 0x50534a51; // "PSJQ"
+
+enum {
+	JournalEnqueue = 'E',
+	JournalDequeue = 'D',
+	JournalClear   = 'C'
+};
+
+static QString journalFileName(const QString &fname)
+{
+	return fname + ".journal";
+}
+
 class EventQueue::Private
 {
 public:
-	Private() { }
+	Private()
+		: journal(0)
+		, journalRecords(0)
+		, generation(0)
+		, replaying(false)
+	{ }
+
+	~Private()
+	{
+		delete journal;
+	}
 
 	QList<EventItem*> list;
 	PsiCon *psi;
 	PsiAccount *account;
+
+	QString file;
+	QFile *journal;
+	int journalRecords;
+	int generation;
+	bool replaying;
 };
 
 EventQueue::EventQueue(PsiAccount *account)
@@ -671,6 +708,8 @@ EventQueue::EventQueue(const EventQueue &from)
 
 EventQueue::~EventQueue()
 {
+	if (d->journalRecords > 0)
+		compact();
 	delete d;
 }
 
@@ -721,6 +760,7 @@ void EventQueue::enqueue(PsiEvent *e)
 	if ( !found )
 		d->list.append(i);
 
+	journal(JournalEnqueue, i);
 	emit queueChanged();
 }
 
@@ -732,6 +772,7 @@ void EventQueue::dequeue(PsiEvent *e)
 	foreach(EventItem *i, d->list) {
 		if ( e == i->event() ) {
 			d->list.remove(i);
+			journal(JournalDequeue, i);
 			emit queueChanged();
 			delete i;
 			return;
@@ -746,6 +787,7 @@ PsiEvent *EventQueue::dequeue(const Jid &j, bool compareRes)
 		Jid j2(e->jid());
 		if(j.compare(j2, compareRes)) {
 			d->list.remove(i);
+			journal(JournalDequeue, i);
 			emit queueChanged();
 			delete i;
 			return e;
@@ -778,6 +820,7 @@ PsiEvent *EventQueue::dequeueNext()
 		return 0;
 	PsiEvent *e = i->event();
 	d->list.remove(i);
+	journal(JournalDequeue, i);
 	emit queueChanged();
 	delete i;
 	return e;
@@ -826,6 +869,7 @@ void EventQueue::extractChats(QList<PsiEvent*> *el, const Jid &j, bool compareRe
 				el->append(me);
 				EventItem* ei = *it;
 				it = d->list.erase(it);
+				journal(JournalDequeue, ei);
 				delete ei;
 				changed = true;
 				continue;
@@ -849,6 +893,7 @@ void EventQueue::extractMessages(QList<PsiEvent*> *el)
 			el->append(e);
 			EventItem* ei = *it;
 			it = d->list.erase(it);
+			journal(JournalDequeue, ei);
 			delete ei;
 			changed = true;
 			continue;
@@ -873,6 +918,7 @@ void EventQueue::clear()
 	while(!d->list.isEmpty()) 
 		delete d->list.takeFirst();
 
+	journal(JournalClear);
 	emit queueChanged();
 }
 
@@ -887,6 +933,7 @@ void EventQueue::clear(const Jid &j, bool compareRes)
 		if(j.compare(j2, compareRes)) {
 			EventItem* ei = *it;
 			it = d->list.erase(it);
+			journal(JournalDequeue, ei);
 			delete ei;
 			changed = true;
 		}
@@ -917,10 +964,12 @@ QDomElement EventQueue::toXml(QDomDocument *doc) const
 {
 	QDomElement e = doc->createElement("eventQueue");
 	e.setAttribute("version", "1.0");
+	e.setAttribute("journal", d->generation);
 	e.appendChild(textTag(doc, "progver", ApplicationInfo::version()));
 
 	foreach(EventItem *i, d->list) {
 		QDomElement event = i->event()->toXml(doc);
+		event.setAttribute("queueid", i->id());
 		e.appendChild( event );
 	}
 
@@ -986,9 +1035,161 @@ bool EventQueue::fromFile(const QString &fname)
 {
 	AtomicXmlFile f(fname);
 	QDomDocument doc;
-	if (!f.loadDocument(&doc))
-		return false;
+	bool haveSnapshot = f.loadDocument(&doc);
+	if (!haveSnapshot) {
+		QDomElement e = doc.createElement("eventQueue");
+		e.setAttribute("version", "1.0");
+		doc.appendChild(e);
+	}
 
 	QDomElement base = doc.documentElement();
-	return fromXml(&base);
+	if (!replayJournal(fname, &base) && !haveSnapshot)
+		return false;
+	if (fname == d->file)
+		d->generation = base.attribute("journal").toInt();
+
+	d->replaying = true;
+	bool ok = fromXml(&base);
+	d->replaying = false;
+
+	// the restored events got new ids, so start over with a fresh snapshot
+	if (fname == d->file)
+		compact();
+	return ok;
+}
+
+/**
+ * Applies the journal belonging to \a fname to the snapshot \a base.
+ * Returns false if there is no journal matching this snapshot.
+ */
+bool EventQueue::replayJournal(const QString &fname, QDomElement *base)
+{
+	QFile f(journalFileName(fname));
+	if (!f.open(QIODevice::ReadOnly))
+		return false;
+
+	QDataStream s(&f);
+	s.setVersion(QDataStream::Qt_4_2);
+	quint32 magic;
+	qint32 generation;
+	s >> magic >> generation;
+	if (s.status() != QDataStream::Ok || magic != eventJournalMagic || generation != base->attribute("journal").toInt())
+		return false;
+
+	QMap<int, QDomElement> events;
+	for (QDomElement e = base->firstChildElement("event"); !e.isNull(); e = e.nextSiblingElement("event"))
+		events.insert(e.attribute("queueid").toInt(), e);
+
+	while (!s.atEnd()) {
+		quint8 op;
+		qint32 id;
+		QString xml;
+		s >> op >> id;
+		if (op == JournalEnqueue)
+			s >> xml;
+		if (s.status() != QDataStream::Ok)
+			break; // incomplete last record
+
+		if (op == JournalEnqueue) {
+			QDomDocument ed;
+			if (!ed.setContent(xml))
+				continue;
+			QDomElement e = base->ownerDocument().importNode(ed.documentElement(), true).toElement();
+			e.setAttribute("queueid", id);
+			base->appendChild(e);
+			events.insert(id, e);
+		}
+		else if (op == JournalDequeue) {
+			if (events.contains(id))
+				base->removeChild(events.take(id));
+		}
+		else if (op == JournalClear) {
+			foreach(QDomElement e, events)
+				base->removeChild(e);
+			events.clear();
+		}
+	}
+
+	return true;
+}
+
+/**
+ * Keeps \a fname up to date with the queue contents: changes are appended
+ * to a journal next to it and periodically compacted into \a fname.
+ * Call this before fromFile().  An empty \a fname stops persisting.
+ */
+void EventQueue::setJournal(const QString &fname)
+{
+	if (fname.isEmpty()) {
+		delete d->journal;
+		d->journal = 0;
+		d->journalRecords = 0;
+		d->file = QString();
+		return;
+	}
+
+	if (!d->file.isEmpty() && d->file != fname && d->journal) {
+		// move the queue over to the new file
+		QString old = d->file;
+		d->file = fname;
+		if (compact()) {
+			QFile::remove(old);
+			QFile::remove(journalFileName(old));
+		}
+		return;
+	}
+	d->file = fname;
+}
+
+/**
+ * Writes a fresh snapshot and starts an empty journal.
+ */
+bool EventQueue::compact()
+{
+	if (d->file.isEmpty())
+		return false;
+
+	delete d->journal;
+	d->journal = 0;
+	d->journalRecords = 0;
+
+	++d->generation;
+	if (!toFile(d->file))
+		return false;
+
+	QFile *f = new QFile(journalFileName(d->file));
+	if (!f->open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+		delete f;
+		return false;
+	}
+
+	QDataStream s(f);
+	s.setVersion(QDataStream::Qt_4_2);
+	s << eventJournalMagic << (qint32)d->generation;
+	f->flush();
+	d->journal = f;
+	return true;
+}
+
+void EventQueue::journal(int op, EventItem *i)
+{
+	if (d->file.isEmpty() || d->replaying)
+		return;
+
+	// without a journal (or with a long one) save the whole queue instead
+	if (!d->journal || d->journalRecords >= EVENTQUEUE_COMPACT_RECORDS) {
+		compact();
+		return;
+	}
+
+	QDataStream s(d->journal);
+	s.setVersion(QDataStream::Qt_4_2);
+	s << (quint8)op << (qint32)(i ? i->id() : -1);
+	if (op == JournalEnqueue) {
+		QDomDocument doc;
+		doc.appendChild(i->event()->toXml(&doc));
+		s << doc.toString(0);
+	}
+	d->journal->flush();
+	++d->journalRecords;
 }
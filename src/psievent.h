@@ -313,11 +313,17 @@ public:
 	bool toFile(const QString &fname);
 	bool fromFile(const QString &fname);
 
+	void setJournal(const QString &fname);
+	bool compact();
+
 signals:
 	void eventFromXml(PsiEvent *);
 	void queueChanged();
 
 private:
+	void journal(int op, EventItem *i = 0);
+	bool replayJournal(const QString &fname, QDomElement *base);
+
 	class Private;
 	Private *d;
 };
@@ -24,12 +24,14 @@
 #include "userlist.h"
 #include "anim.h"
 #include "applicationinfo.h"
+#include "emoticonmatcher.h"
 
 #include "psioptions.h"
 
 #include <QFileInfo>
 #include <QCoreApplication>
 #include <QSet>
+#include <QHash>
 
 using namespace XMPP;
 
@@ -47,11 +49,22 @@ public:
 	QStringList cur_emoticons;
 	QMap<QString, QString> cur_service_status;
 	QMap<QString, QString> cur_custom_status;
+	EmoticonMatcher *emoticonMatcher;
+
+	// jid2icon() results of statusPtr(jid, status), by status and bare jid.
+	// they only depend on the options and roster iconsets, so the cache is
+	// cleared whenever those change
+	QHash<int, QHash<QString, PsiIcon *> > statusIcons;
 
 	Private(PsiIconset *_psi) {
 		psi = _psi;
 		psi->emoticons.setAutoDelete(true);
 		psi->roster.setAutoDelete(true);
+		emoticonMatcher = 0;
+	}
+
+	~Private() {
+		delete emoticonMatcher;
 	}
 
 	QString iconsetPath(QString name) {
@@ -277,6 +290,7 @@ bool PsiIconset::loadSystem()
 
 		//d->system = d->systemIconset();
 		d->system.addToFactory();
+		d->statusIcons.clear();
 
 		d->cur_system = cur_system;
 	}
@@ -288,6 +302,7 @@ bool PsiIconset::loadRoster()
 {
 	// load roster
 	roster.clear();
+	d->statusIcons.clear();
 
 	// default roster iconset
 	bool ok;
@@ -340,6 +355,8 @@ void PsiIconset::loadEmoticons()
 {
 	QStringList cur_emoticons = PsiOptions::instance()->getOption("options.iconsets.emoticons").toStringList();
 	if (d->cur_emoticons != cur_emoticons) {
+		delete d->emoticonMatcher;
+		d->emoticonMatcher = 0;
 		emoticons.clear();
 		emoticons = d->emoticons();
 
@@ -348,6 +365,17 @@ void PsiIconset::loadEmoticons()
 	}
 }
 
+/**
+ * Returns the matcher for the texts of all loaded emoticons.  It is
+ * rebuilt the first time it is needed after the emoticons change.
+ */
+const EmoticonMatcher &PsiIconset::emoticonMatcher()
+{
+	if (!d->emoticonMatcher)
+		d->emoticonMatcher = new EmoticonMatcher(emoticons);
+	return *d->emoticonMatcher;
+}
+
 bool PsiIconset::loadAll()
 {
 	if (!loadSystem() || !loadRoster())
@@ -359,6 +387,10 @@ bool PsiIconset::loadAll()
 
 void PsiIconset::optionChanged(const QString& option)
 {
+	if (option.startsWith("options.iconsets.") || option == "options.ui.contactlist.use-transport-icons") {
+		d->statusIcons.clear();
+	}
+
 	if (option == "options.iconsets.system") {
 		loadSystem();
 	}
@@ -380,6 +412,8 @@ void PsiIconset::optionChanged(const QString& option)
 
 void PsiIconset::reloadRoster()
 {
+	d->statusIcons.clear();
+
 	bool ok;
 	QString cur_status = PsiOptions::instance()->getOption("options.iconsets.status").toString();
 	// default roster iconset
@@ -609,7 +643,15 @@ PsiIcon PsiIconset::transportStatus(QString name, const XMPP::Status &s)
 
 PsiIcon *PsiIconset::statusPtr(const XMPP::Jid &jid, int s)
 {
-	return d->jid2icon(jid, status2name(s));
+	// called by the roster painters on every repaint
+	QHash<QString, PsiIcon *> &icons = d->statusIcons[s];
+	QHash<QString, PsiIcon *>::ConstIterator it = icons.find(jid.bare());
+	if (it != icons.end())
+		return it.value();
+
+	PsiIcon *icon = d->jid2icon(jid, status2name(s));
+	icons.insert(jid.bare(), icon);
+	return icon;
 }
 
 PsiIcon *PsiIconset::statusPtr(const XMPP::Jid &jid, const XMPP::Status &s)
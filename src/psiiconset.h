@@ -29,6 +29,7 @@
 
 class PsiEvent;
 class UserListItem;
+class EmoticonMatcher;
 namespace XMPP {
 	class Status;
 	class Jid;
@@ -46,6 +47,7 @@ public:
 
 	Q3Dict<Iconset> roster;
 	Q3PtrList<Iconset> emoticons;
+	const EmoticonMatcher &emoticonMatcher();
 	const Iconset &system() const;
 	void stripFirstAnimFrame(Iconset *);
 	static void removeAnimation(Iconset *);
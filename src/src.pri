@@ -103,6 +103,7 @@ include($$PWD/../iris/iris.pri)
 HEADERS += \
 	$$PWD/varlist.h \ 
 	$$PWD/jidutil.h \
+	$$PWD/xmlringbuffer.h \
 	$$PWD/showtextdlg.h \ 
 	$$PWD/profiles.h \
 	$$PWD/activeprofiles.h \
@@ -128,6 +129,7 @@ HEADERS += \
 	$$PWD/mainwin_p.h \
 	$$PWD/psitrayicon.h \
 	$$PWD/rtparse.h \
+	$$PWD/emoticonmatcher.h \
 	$$PWD/systeminfo.h \
 	$$PWD/common.h \
 	$$PWD/proxy.h \
@@ -217,6 +219,7 @@ HEADERS += \
 SOURCES += \
 	$$PWD/varlist.cpp \
 	$$PWD/jidutil.cpp \
+	$$PWD/xmlringbuffer.cpp \
 	$$PWD/showtextdlg.cpp \
 	$$PWD/psi_profiles.cpp \
 	$$PWD/activeprofiles.cpp \
@@ -241,6 +244,7 @@ SOURCES += \
 	$$PWD/mainwin_p.cpp \
 	$$PWD/psitrayicon.cpp \
 	$$PWD/rtparse.cpp \
+	$$PWD/emoticonmatcher.cpp \
 	$$PWD/systeminfo.cpp \
 	$$PWD/common.cpp \
 	$$PWD/proxy.cpp \
@@ -732,13 +732,13 @@ void SxeManager::groupChatJoined(const Jid &, const Jid &ownJid) {
 }
 
 bool SxeManager::checkSupport(const Jid &jid, const QList<QString> &features) {
-    QStringList supported = pa_->capsManager()->features(jid).list();
+    CapsManager *caps = pa_->capsManager();
 
-    if(!supported.contains(SXENS))
+    if(!caps->hasFeature(jid, SXENS))
         return false;
 
     foreach(QString f, features) {
-        if(!supported.contains(f))
+        if(!caps->hasFeature(jid, f))
             return false;
     }
 
@@ -21,6 +21,7 @@
 #include "sxesession.h"
 
 #include "QTimer"
+#include "QtAlgorithms"
 #include "QUuid"
 
 // The maxlength of a chdata that gets put in one edit
@@ -28,6 +29,15 @@ enum {MAXCHDATA = 1024};
 
 using namespace XMPP;
 
+// QDomNode has no qHash(), so nodes are looked up by their shared private
+// data, which is also what QDomNode::operator==() compares.
+class SxeNodeKey : public QDomNode {
+public:
+    static const void* of(const QDomNode &node) {
+        return node.*(&SxeNodeKey::impl);
+    }
+};
+
 //----------------------------------------------------------------------------
 // SxeSession
 //----------------------------------------------------------------------------
@@ -43,6 +53,8 @@ SxeSession::SxeSession(const Jid &target, const QString &session, const Jid &own
     queueing_ = false;
     importing_ = true;
     highestWeight_ = 0;
+    batchDepth_ = 0;
+    batchRemote_ = false;
 }
 
 SxeSession::~SxeSession() {
@@ -51,13 +63,16 @@ SxeSession::~SxeSession() {
 
 void SxeSession::initializeDocument(const QDomDocument &doc) {
     importing_ = true;
+    beginBatch();
 
     // reset the document
     doc_ = QDomDocument();
     foreach(SxeRecord* meta, recordByNodeId_.values())
         meta->deleteLater();
-    // recordByNode_.clear();
+    recordByNode_.clear();
     recordByNodeId_.clear();
+    siblingsByParent_.clear();
+    siblingPosition_.clear();
     queuedIncomingEdits_.clear();
     queuedOutgoingEdits_.clear();
 
@@ -74,6 +89,7 @@ void SxeSession::initializeDocument(const QDomDocument &doc) {
             generateNewNode(children.at(i), QString(), i);
     }
 
+    endBatch();
     importing_ = false;
 }
 
@@ -105,7 +121,8 @@ void SxeSession::processIncomingSxeElement(const QDomElement &sxe, const Jid &se
             queuedIncomingEdits_.append(incoming);
         }
     } else {
-        // otherwise, process all the edits
+        // otherwise, process all the edits as one batch
+        beginBatch();
         foreach(SxeEdit* e, edits) {
             SxeRecord* meta;
             if(e->type() == SxeEdit::New)
@@ -120,7 +137,7 @@ void SxeSession::processIncomingSxeElement(const QDomElement &sxe, const Jid &se
         // Save the information of last processed sxe
         setLastSxe(sender.full(), sxe.attribute("id"));
 
-        emit documentUpdated(true);
+        endBatch();
     }
 }
 
@@ -203,6 +220,7 @@ void SxeSession::stopQueueing() {
 
     // Process queued elements
     flush();
+    beginBatch();
     while(!queuedIncomingEdits_.isEmpty()) {
         IncomingEdit incoming = queuedIncomingEdits_.takeFirst();
         setLastSxe(incoming.sender.full(), incoming.sxeid);
@@ -216,6 +234,7 @@ void SxeSession::stopQueueing() {
         if(meta)
             meta->apply(doc_, incoming.edit, false);
     }
+    endBatch();
     
     queueing_ = false;
 }
@@ -289,12 +308,14 @@ const QDomNode SxeSession::insertNodeAfter(const QDomNode &node, const QDomNode
         // insert the first node relative to the specified referenceNode
         QDomNode reference = referenceNode;
         QDomNodeList children = node.childNodes();
+        beginBatch();
         for(int i = 0; i < children.size(); i++) {
             QDomNode newNode = children.at(i);
             insertNodeAfter(newNode, parent, reference);
             // and the rest relative to the previous sibling
             reference = newNode;
         }
+        endBatch();
 
         return QDomNode();
     }
@@ -331,7 +352,8 @@ const QDomNode SxeSession::insertNodeAfter(const QDomNode &node, const QDomNode
 }
 
 const QDomNode SxeSession::insertNode(const QDomNode &node, const QString &parentId, double primaryWeight) {
-    QDomNode newNode;
+    QDomNode result;
+    beginBatch();
 
     SxeRecord* meta = record(node);
     if(meta) {
@@ -353,20 +375,16 @@ const QDomNode SxeSession::insertNode(const QDomNode &node, const QString &paren
         
             // send the edit to others
             queueOutgoingEdit(edit);
-
-            emit documentUpdated(false);
         }
-        return node;
+        result = node;
 
     } else {
-
-        QList<SxeEdit*> edits;
         // create a new node
-        QDomNode result = generateNewNode(node, parentId, primaryWeight);
-
-        emit documentUpdated(false);
-        return result;
+        result = generateNewNode(node, parentId, primaryWeight);
     }
+
+    endBatch();
+    return result;
 }
 
 void SxeSession::removeNode(const QDomNode &node) {
@@ -374,10 +392,10 @@ void SxeSession::removeNode(const QDomNode &node) {
         return;
 
     // create SxeRemoveEdits for all child nodes
+    beginBatch();
     generateRemoves(node);
     flush();
-
-    emit documentUpdated(false);
+    endBatch();
 }
 
 void SxeSession::setAttribute(const QDomNode &node, const QString &attribute, const QString &value, int from, int n) {
@@ -447,12 +465,12 @@ void SxeSession::setNodeValue(const QDomNode &node, const QString &value, int fr
     SxeRecordEdit* edit = new SxeRecordEdit(meta->rid(), meta->version() + 1, changes);
 
     // apply it
+    beginBatch();
     meta->apply(doc_, edit, false);
     
     // send the edit to others
     queueOutgoingEdit(edit);
-
-    emit documentUpdated(false);
+    endBatch();
 }
 
 void SxeSession::flush() {
@@ -552,6 +570,9 @@ void SxeSession::reposition(const QDomNode &node, bool remote) {
         return;
     }
 
+    // forget the old position of a moved node
+    unindexSibling(meta);
+
     // inserting nodes to the document node is a special case
     if(meta->parent().isEmpty()) {
         if(node.isElement() && !(doc_.documentElement().isNull() || doc_.documentElement() == node)) {
@@ -602,26 +623,17 @@ void SxeSession::reposition(const QDomNode &node, bool remote) {
         return;
     }
 
-    // get the list of siblings
-    QDomNodeList children = parentNode.childNodes();
+    // find the indexed sibling with the smallest weight greater than the weight of the node itself
+    // if any, insert the node before that node
+    int position = indexSibling(meta);
+    const QList<Sibling> &siblings = siblingsByParent_[meta->parent()];
 
     // default to appending
     QDomNode before;
     bool insertLast = true;
-    if(children.length() > 0) {
-        // find the child with the smallest weight greater than the weight of the node itself
-        // if any, insert the node before that node
-        for(uint i=0; i < children.length(); i++) {
-            if(children.item(i) != node) {
-                SxeRecord* siblingMeta = record(children.item(i));
-                if(siblingMeta && *meta < *siblingMeta) {
-                    // qDebug(QString("%1 (pw: %2) is less than %3 (pw: %4)").arg(meta->name()).arg(meta->primaryWeight()).arg(siblingMeta->name()).arg(siblingMeta->primaryWeight()).toAscii());
-                    before = children.item(i);
-                    insertLast = false;
-                    break;
-                }
-            }
-        }
+    if(position + 1 < siblings.size()) {
+        before = siblings.at(position + 1).record->node();
+        insertLast = before.parentNode() != parentNode;
     }
 
     if(insertLast) {
@@ -633,40 +645,163 @@ void SxeSession::reposition(const QDomNode &node, bool remote) {
     }
 }
 
-// void SxeSession::addToLookup(const QDomNode &node, bool, const QString &rid) {
-    // recordByNode_[node]
-    //     = recordByNodeId_[rid];
-// }
+void SxeSession::handleNodeToBeAdded(const QDomNode &node, bool remote, const QString &rid) {
+    // once the node is actually created, add it to the lookup table
+    if(recordByNodeId_.contains(rid))
+        recordByNode_[SxeNodeKey::of(node)] = recordByNodeId_[rid];
 
-void SxeSession::handleNodeToBeAdded(const QDomNode &node, bool remote) {
     emit nodeToBeAdded(node, remote);
     reposition(node, remote);
     emit nodeAdded(node, remote);
+    recordChange(node, Added, remote);
 }
 
 void SxeSession::handleNodeToBeMoved(const QDomNode &node, bool remote) {
     emit nodeToBeMoved(node, remote);
     reposition(node, remote);
     emit nodeMoved(node, remote);
+    recordChange(node, Moved, remote);
 }
 
 void SxeSession::handleNodeToBeRemoved(const QDomNode &node, bool remote) {
     emit nodeToBeRemoved(node, remote);
+    recordChange(node, Removed, remote);
     removeRecord(node);
 }
 
+void SxeSession::handleChdataChanged(const QDomNode &node, bool remote) {
+    emit chdataChanged(node, remote);
+    recordChange(node, Changed, remote);
+}
 
-void SxeSession::removeRecord(const QDomNode &node) {
-    QMutableHashIterator<QString, SxeRecord*> i(recordByNodeId_);
+void SxeSession::beginBatch() {
+    batchDepth_++;
+}
 
-    while(i.hasNext()) {
-        if(node == i.next().value()->node()) {
-            i.remove();
-            return;
-        }
+void SxeSession::endBatch() {
+    if(batchDepth_ <= 0) {
+        qDebug("endBatch() called without a matching beginBatch().");
+        return;
+    }
+
+    if(--batchDepth_ > 0)
+        return;
+
+    if(changes_.isEmpty())
+        return;
+
+    // drop the nodes that were removed again during the batch
+    SxeChangeSet changes;
+    foreach(QDomNode node, changes_.added) {
+        if(!(changeFlags_.value(SxeNodeKey::of(node)) & Removed))
+            changes.added += node;
+    }
+    foreach(QDomNode node, changes_.moved) {
+        if(!(changeFlags_.value(SxeNodeKey::of(node)) & Removed))
+            changes.moved += node;
+    }
+    foreach(QDomNode node, changes_.changed) {
+        if(!(changeFlags_.value(SxeNodeKey::of(node)) & Removed))
+            changes.changed += node;
+    }
+    changes.removed = changes_.removed;
+
+    bool remote = batchRemote_;
+
+    // reset before emitting in case the receivers edit the document
+    changes_ = SxeChangeSet();
+    changeFlags_.clear();
+    batchRemote_ = false;
+
+    if(changes.isEmpty())
+        return;
+
+    emit documentChanged(changes, remote);
+    emit documentUpdated(remote);
+}
+
+void SxeSession::recordChange(const QDomNode &node, ChangeFlag change, bool remote) {
+    if(batchDepth_ == 0) {
+        // a change outside of any batch is a batch of its own
+        beginBatch();
+        recordChange(node, change, remote);
+        endBatch();
+        return;
+    }
+
+    batchRemote_ = batchRemote_ || remote;
+
+    int &flags = changeFlags_[SxeNodeKey::of(node)];
+    int previous = flags;
+    flags |= change;
+    if(previous & change)
+        return;
+
+    if(change == Added)
+        changes_.added += node;
+    else if(change == Removed) {
+        // a node that was both added and removed during the batch was never seen by the receivers
+        if(!(previous & Added))
+            changes_.removed += node;
+    } else if(!(previous & Added)) {
+        // the position and chdata of a node added during the batch are already current
+        if(change == Moved)
+            changes_.moved += node;
+        else
+            changes_.changed += node;
     }
 }
 
+
+void SxeSession::removeRecord(const QDomNode &node) {
+    SxeRecord* meta = recordByNode_.take(SxeNodeKey::of(node));
+    if(!meta)
+        return;
+
+    unindexSibling(meta);
+    siblingsByParent_.remove(meta->rid());
+    recordByNodeId_.remove(meta->rid());
+}
+
+int SxeSession::indexSibling(SxeRecord* meta) {
+    Sibling sibling;
+    sibling.weight = meta->primaryWeight();
+    sibling.record = meta;
+
+    QList<Sibling> &siblings = siblingsByParent_[meta->parent()];
+    QList<Sibling>::iterator it = qLowerBound(siblings.begin(), siblings.end(), sibling, siblingLessThan);
+    int position = it - siblings.begin();
+    siblings.insert(position, sibling);
+
+    siblingPosition_[meta] = qMakePair(meta->parent(), sibling.weight);
+    return position;
+}
+
+void SxeSession::unindexSibling(SxeRecord* meta) {
+    if(!siblingPosition_.contains(meta))
+        return;
+
+    QPair<QString, double> indexed = siblingPosition_.take(meta);
+    QHash<QString, QList<Sibling> >::iterator parent = siblingsByParent_.find(indexed.first);
+    if(parent == siblingsByParent_.end())
+        return;
+
+    Sibling sibling;
+    sibling.weight = indexed.second;
+    sibling.record = meta;
+
+    QList<Sibling> &siblings = parent.value();
+    QList<Sibling>::iterator it = qLowerBound(siblings.begin(), siblings.end(), sibling, siblingLessThan);
+    if(it != siblings.end() && it->record == meta)
+        siblings.erase(it);
+}
+
+bool SxeSession::siblingLessThan(const Sibling &a, const Sibling &b) {
+    if(a.weight != b.weight)
+        return a.weight < b.weight;
+    return a.record->hasSmallerSecondaryWeight(*b.record);
+}
+
 bool SxeSession::removeSmaller(SxeRecord* meta1, SxeRecord* meta2) {
     if(!meta1)
         return true;
@@ -703,18 +838,15 @@ SxeRecord* SxeSession::createRecord(const QString &id) {
     SxeRecord* m = new SxeRecord(id);
     recordByNodeId_[id] = m;
 
-    // once the node is actually created, add it to the lookup table
-    // connect(m, SIGNAL(nodeAdded(QDomNode, bool, QString)), SLOT(addToLookup(const QDomNode &, bool, const QString &)));
-
     // remove the node in case of a conflicting edit
     connect(m, SIGNAL(nodeRemovalRequired(QDomNode)), SLOT(removeNode(QDomNode)));
 
     // reposition and emit public signals as needed when record is changed
-    connect(m, SIGNAL(nodeToBeAdded(QDomNode, bool, QString)), SLOT(handleNodeToBeAdded(const QDomNode &, bool)));
+    connect(m, SIGNAL(nodeToBeAdded(QDomNode, bool, QString)), SLOT(handleNodeToBeAdded(const QDomNode &, bool, const QString &)));
     connect(m, SIGNAL(nodeToBeMoved(QDomNode, bool)), SLOT(handleNodeToBeMoved(const QDomNode &, bool)));
     connect(m, SIGNAL(nodeToBeRemoved(QDomNode, bool)), SLOT(handleNodeToBeRemoved(const QDomNode &, bool)));
     connect(m, SIGNAL(chdataToBeChanged(QDomNode, bool)), SIGNAL(chdataToBeChanged(const QDomNode &, bool)));
-    connect(m, SIGNAL(chdataChanged(QDomNode, bool)), SIGNAL(chdataChanged(const QDomNode &, bool)));
+    connect(m, SIGNAL(chdataChanged(QDomNode, bool)), SLOT(handleChdataChanged(const QDomNode &, bool)));
     // connect(m, SIGNAL(nameChanged(QDomNode, bool)), SIGNAL(nameChanged(const QDomNode &, bool)));
     
     return m;
@@ -728,14 +860,7 @@ SxeRecord* SxeSession::record(const QDomNode &node) const {
     if(node.isNull())
         return NULL;
 
-    // go through all the SxeRecord's
-    foreach(SxeRecord* meta, recordByNodeId_.values()) {
-        // qDebug(QString("id: %1").arg(meta->rid()).toAscii());
-        if(node == meta->node())
-            return meta;
-    }
-    
-    return NULL;
+    return recordByNode_.value(SxeNodeKey::of(node));
 }
 
 QString SxeSession::generateUUIDForSession() {
@@ -25,6 +25,8 @@
 
 #include <QObject>
 #include <QList>
+#include <QHash>
+#include <QPair>
 #include <QPointer>
 #include <QDomNode>
 #include "im.h"
@@ -40,6 +42,24 @@ namespace XMPP {
 
 using namespace XMPP;
 
+/*! \brief The nodes affected by one batch of applied edits.
+ *  Each node is listed at most once. Nodes added during the batch are only listed in \a added
+ *  and nodes that were removed again are dropped from all but \a removed.
+ */
+struct SxeChangeSet {
+    /*! \brief Nodes inserted into the document.*/
+    QList<QDomNode> added;
+    /*! \brief Nodes whose parent or primary-weight changed.*/
+    QList<QDomNode> moved;
+    /*! \brief Nodes whose chdata changed.*/
+    QList<QDomNode> changed;
+    /*! \brief Nodes removed from the document.*/
+    QList<QDomNode> removed;
+
+    /*! \brief Returns true if no node was affected.*/
+    bool isEmpty() const { return added.isEmpty() && moved.isEmpty() && changed.isEmpty() && removed.isEmpty(); }
+};
+
 /*! \brief Class for storing the record and the XML document for an established SXE session.*/
 class SxeSession : public QObject {
     Q_OBJECT
@@ -54,6 +74,15 @@ class SxeSession : public QObject {
             SxeEdit* edit;
         };
 
+        /*! \brief The kinds of changes collected for a node during a batch. */
+        enum ChangeFlag { Added = 1, Moved = 2, Changed = 4, Removed = 8 };
+
+        /*! \brief The position of a record among the children of its parent. */
+        struct Sibling {
+            double weight;
+            SxeRecord* record;
+        };
+
     public:
         /*! \brief Constructor.
         *  Creates a new session for the specified jid and session identifier.
@@ -103,6 +132,14 @@ class SxeSession : public QObject {
         QHash<QString, QString> lastSxe() const;
         /*! \brief Sets the information identifying the last processed sxe.*/
         void setLastSxe(const QString &sender, const QString &id);
+        /*! \brief Starts collecting the changes to the document into one batch.
+         *  Batches may be nested; only the outermost endBatch() emits the signals.
+         */
+        void beginBatch();
+        /*! \brief Ends a batch started with beginBatch().
+         *  When the outermost batch ends, emits documentChanged() and documentUpdated() once if anything changed.
+         */
+        void endBatch();
 
         /*! \brief Returns a random UUID without enclosing { }. */
         static QString generateUUID();
@@ -136,8 +173,10 @@ class SxeSession : public QObject {
         /*! \brief used to pass the new <sxe/> elements to sxemanager.*/
         void newSxeElement(const QDomElement &element, const Jid &, bool groupChat);
 
-        /*! \brief Emitted after each processed SXE element.*/
+        /*! \brief Emitted after each processed SXE element or local change that affected the document.*/
         void documentUpdated(bool remote);
+        /*! \brief Emitted just before documentUpdated() with the nodes affected since the last emission.*/
+        void documentChanged(const SxeChangeSet &changes, bool remote);
         /*! \brief Emitted just before \a node is inserted.*/
         void nodeToBeAdded(const QDomNode &node, bool remote);
         /*! \brief Emitted after \a node is inserted.*/
@@ -165,14 +204,14 @@ class SxeSession : public QObject {
         void sessionEnded(SxeSession*);
 
     private slots:
-        /*! \brief Adds \a node to the document tree and emits the appropriate public signals. */
-        void handleNodeToBeAdded(const QDomNode &node, bool remote);
+        /*! \brief Adds \a node to the lookup table and the document tree and emits the appropriate public signals. */
+        void handleNodeToBeAdded(const QDomNode &node, bool remote, const QString &rid);
         /*! \brief Moves \a node in the document tree and emits the appropriate public signals. */
         void handleNodeToBeMoved(const QDomNode &node, bool remote);
         /*! \brief Remove the record entry from the lookup tables and emit the appropriate public signals. */
         void handleNodeToBeRemoved(const QDomNode &node, bool remote);
-        /*! \brief Add a node node to the lookup table. */
-        // void addToLookup(const QDomNode &node, bool, const QString &rid);
+        /*! \brief Emits chdataChanged() and adds \a node to the current change set. */
+        void handleChdataChanged(const QDomNode &node, bool remote);
 
     private:
         /*! \brief Inserts or moves a node according to it's record (parent and primary-weight). */
@@ -184,6 +223,8 @@ class SxeSession : public QObject {
         bool removeSmaller(SxeRecord* meta1, SxeRecord* meta2);
         /*! \brief Processes an incoming sxe element.*/
         bool processSxe(const QDomElement &sxe);
+        /*! \brief Adds \a node to the change set of the current batch. */
+        void recordChange(const QDomNode &node, ChangeFlag change, bool remote);
         /*! \brief Queues an outgoing edit to be sent when flushed.*/
         void queueOutgoingEdit(SxeEdit* edit);
         /*! \brief Creates the record of node with rid \a id. Returns a pointer to it. */
@@ -192,6 +233,13 @@ class SxeSession : public QObject {
         SxeRecord* record(const QString &id);
         /*! \brief Returns a pointer to the record of \a node. */
         SxeRecord* record(const QDomNode &node) const;
+        /*! \brief Adds \a meta to the weight-ordered sibling index of its parent.
+         *  Returns the position of \a meta among the indexed siblings. */
+        int indexSibling(SxeRecord* meta);
+        /*! \brief Removes \a meta from the sibling index, if it is in it. */
+        void unindexSibling(SxeRecord* meta);
+        /*! \brief Orders siblings the same way as SxeRecord::operator<(). */
+        static bool siblingLessThan(const Sibling &a, const Sibling &b);
         /*! \brief Generates SxeNewEdits for \a node and its children.
          *  Returns the created node. */
         QDomNode generateNewNode(const QDomNode &node, const QString &parent, double primaryWeight);
@@ -220,6 +268,12 @@ class SxeSession : public QObject {
                 QString,
                 SxeRecord*
              > recordByNodeId_;
+        /*! \brief Hash used for node -> SxeRecord* lookups, keyed on the shared node data.*/
+        QHash<const void*, SxeRecord*> recordByNode_;
+        /*! \brief The indexed children of each parent rid ordered by weight.*/
+        QHash<QString, QList<Sibling> > siblingsByParent_;
+        /*! \brief The parent rid and primary-weight each record was indexed with.*/
+        QHash<SxeRecord*, QPair<QString, double> > siblingPosition_;
         /*! \brief List of queued incoming sxe elements.*/
         QList<IncomingEdit> queuedIncomingEdits_;
         /*! \brief List of queued outgoing sxe elements.*/
@@ -238,6 +292,14 @@ class SxeSession : public QObject {
         QList<QString> features_;
          /*! \brief A string that identifies the last edit that was processed.*/
         QHash<QString, QString> lastSxe_;
+        /*! \brief The nesting depth of beginBatch() calls.*/
+        int batchDepth_;
+        /*! \brief True if any change in the current batch was caused by a remote edit.*/
+        bool batchRemote_;
+        /*! \brief The changes collected during the current batch.*/
+        SxeChangeSet changes_;
+        /*! \brief The ChangeFlags collected for each node during the current batch.*/
+        QHash<const void*, int> changeFlags_;
         /*! \brief The highest primary weight value in the document.*/
         int highestWeight_;
         /*! \brief The main DOM document.*/
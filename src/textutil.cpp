@@ -1,9 +1,9 @@
 #include <QTextDocument> // for escape()
-#include <Q3PtrList>
 
 #include "textutil.h"
 #include "psiiconset.h"
 #include "rtparse.h"
+#include "emoticonmatcher.h"
 
 // Qt::escape() doesn't escape " to &quot; -- it sucks
 QString TextUtil::escape(const QString& plain)
@@ -432,80 +432,218 @@ QString TextUtil::linkify(const QString &in)
 // sickening
 QString TextUtil::emoticonify(const QString &in)
 {
+	const EmoticonMatcher &matcher = PsiIconset::instance()->emoticonMatcher();
+
 	RTParse p(in);
 	while ( !p.atEnd() ) {
 		// returns us the first chunk as a plaintext string
 		QString str = p.next();
 
 		int i = 0;
-		while ( i >= 0 ) {
-			// find closest emoticon
-			int ePos = -1;
-			PsiIcon *closest = 0;
-
-			int foundPos = -1, foundLen = -1;
-
-			Q3PtrListIterator<Iconset> iconsets(PsiIconset::instance()->emoticons);
-			Iconset *iconset;
-			while ( (iconset = iconsets.current()) != 0 ) {
-				QListIterator<PsiIcon*> it = iconset->iterator();
-				while ( it.hasNext()) {
-					PsiIcon *icon = it.next();
-					if ( icon->regExp().isEmpty() )
-						continue;
-
-					// some hackery
-					int iii = i;
-					bool searchAgain;
-
-					do {
-						searchAgain = false;
-
-						// find the closest match
-						const QRegExp &rx = icon->regExp();
-						int n = rx.search(str, iii);
-						if ( n == -1 )
-							continue;
-
-						if(ePos == -1 || n < ePos || (rx.matchedLength() > foundLen && n < ePos + foundLen)) {
-							bool leftSpace  = n == 0 || (n > 0 && str[n-1].isSpace());
-							bool rightSpace = (n+rx.matchedLength() == (int)str.length()) || (n+rx.matchedLength() < (int)str.length() && str[n+rx.matchedLength()].isSpace());
-							// there must be whitespace at least on one side of the emoticon
-							if (leftSpace || rightSpace) {
-								ePos = n;
-								closest = icon;
-
-								foundPos = n;
-								foundLen = rx.matchedLength();
-								break;
-							}
-
-							searchAgain = true;
-						}
-
-						iii = n + rx.matchedLength();
-					} while ( searchAgain );
-				}
+		EmoticonMatcher::Match m;
+		while ( matcher.findNext(str, i, &m) ) {
+			p.putPlain(str.mid(i, m.pos - i));
+			p.putRich( QString("<icon name=\"%1\" text=\"%2\">").arg(TextUtil::escape(m.icon->name())).arg(TextUtil::escape(str.mid(m.pos, m.len))) );
+			i = m.pos + m.len;
+		}
+		p.putPlain(str.mid(i));
+	}
+
+	QString out = p.output();
+	return out;
+}
 
-				++iconsets;
+//----------------------------------------------------------------------------
+// single-pass message formatting
+//----------------------------------------------------------------------------
+
+// appends plain text the way plain2rich() escapes it
+static void format_escape(QString *out, const QString &plain, int from, int to)
+{
+	for(int i = from; i < to; ++i) {
+		const QChar c = plain.at(i);
+#ifdef Q_OS_WIN
+		if(c == '\r' && i+1 < to && plain.at(i+1) == '\n')
+			continue;	// Qt/Win sees \r\n as two new line chars
+#endif
+		if(c == '\n')
+			*out += QLatin1String("<br>");
+		else if(c == '<')
+			*out += QLatin1String("&lt;");
+		else if(c == '>')
+			*out += QLatin1String("&gt;");
+		else if(c == '\"')
+			*out += QLatin1String("&quot;");
+		else if(c == '\'')
+			*out += QLatin1String("&apos;");
+		else if(c == '&')
+			*out += QLatin1String("&amp;");
+		else
+			*out += c;
+	}
+}
+
+// the tag legacyFormat() would put around the word, if any
+static const char *format_legacyTag(const QString &plain, int from, int to)
+{
+	if(to - from < 3 || plain.at(from) != plain.at(to-1))
+		return 0;
+	if(plain.at(from) == '_')
+		return "u";
+	if(plain.at(from) == '*')
+		return "b";
+	if(plain.at(from) == '/')
+		return "i";
+	return 0;
+}
+
+static void format_words(QString *out, const QString &plain, int from, int to, bool legacy)
+{
+	if(!legacy) {
+		format_escape(out, plain, from, to);
+		return;
+	}
+
+	int i = from;
+	while(i < to) {
+		int w = i;
+		while(w < to && plain.at(w).isSpace())
+			++w;
+		format_escape(out, plain, i, w);
+
+		int e = w;
+		while(e < to && !plain.at(e).isSpace())
+			++e;
+		const char *tag = format_legacyTag(plain, w, e);
+		if(tag)
+			*out += QString("<%1>").arg(tag);
+		format_escape(out, plain, w, e);
+		if(tag)
+			*out += QString("</%1>").arg(tag);
+		i = e;
+	}
+}
+
+static void format_text(QString *out, const QString &plain, int from, int to, const EmoticonMatcher *matcher, bool legacy)
+{
+	if(!matcher) {
+		format_words(out, plain, from, to, legacy);
+		return;
+	}
+
+	// emoticon boundaries are judged within the text between links
+	QString str = plain.mid(from, to - from);
+	int i = 0;
+	EmoticonMatcher::Match m;
+	while(matcher->findNext(str, i, &m)) {
+		format_words(out, str, i, m.pos, legacy);
+		*out += QString("<icon name=\"%1\" text=\"%2\">").arg(TextUtil::escape(m.icon->name())).arg(TextUtil::escape(str.mid(m.pos, m.len)));
+		i = m.pos + m.len;
+	}
+	format_words(out, str, i, str.length(), legacy);
+}
+
+// finds the next uri in plain text using the rules of linkify()
+static bool format_findLink(const QString &plain, int from, int *start, int *end, QString *href)
+{
+	for(int n = from; n < (int)plain.length(); ++n) {
+		QString prefix;
+		int skip = 0;
+		bool isEmail = false;
+
+		if(linkify_pmatch(plain, n, "http://"))
+			skip = 7;
+		else if(linkify_pmatch(plain, n, "https://"))
+			skip = 8;
+		else if(linkify_pmatch(plain, n, "ftp://"))
+			skip = 6;
+		else if(linkify_pmatch(plain, n, "news://"))
+			skip = 7;
+		else if(linkify_pmatch(plain, n, "ed2k://"))
+			skip = 7;
+		else if(linkify_pmatch(plain, n, "www."))
+			prefix = "http://";
+		else if(linkify_pmatch(plain, n, "ftp."))
+			prefix = "ftp://";
+		else if(plain.at(n) == '@')
+			isEmail = true;
+		else
+			continue;
+
+		if(!isEmail) {
+			// make sure the previous char is not alphanumeric
+			if(n > 0 && plain.at(n-1).isLetterOrNumber())
+				continue;
+
+			// find whitespace (or end), then hack off unwanted punctuation
+			int x2 = n + skip;
+			while(x2 < (int)plain.length() && !plain.at(x2).isSpace())
+				++x2;
+			int cutoff = x2;
+			while(cutoff > n && linkify_isOneOf(plain.at(cutoff-1), "!?,.()[]{}<>\""))
+				--cutoff;
+
+			QString link = plain.mid(n, cutoff - n);
+			if(link.isEmpty() || !linkify_okUrl(link)) {
+				n = cutoff;
+				continue;
 			}
 
-			QString s;
-			if(ePos == -1)
-				s = str.mid(i);
-			else
-				s = str.mid(i, ePos-i);
-			p.putPlain(s);
+			*start = n;
+			*end = cutoff;
+			*href = linkify_htmlsafe(Qt::escape(prefix + link));
+			return true;
+		}
+		else {
+			if(n == 0)
+				continue;
 
-			if ( !closest )
-				break;
+			int x1 = n;
+			while(x1 > from && (linkify_isOneOf(plain.at(x1-1), "_.-") || plain.at(x1-1).isLetterOrNumber()))
+				--x1;
+			int x2 = n + 1;
+			while(x2 < (int)plain.length() && (linkify_isOneOf(plain.at(x2), "_.-") || plain.at(x2).isLetterOrNumber()))
+				++x2;
 
-			p.putRich( QString("<icon name=\"%1\" text=\"%2\">").arg(TextUtil::escape(closest->name())).arg(TextUtil::escape(str.mid(foundPos, foundLen))) );
-			i = foundPos + foundLen;
+			QString link = plain.mid(x1, x2 - x1);
+			if(!linkify_okEmail(link)) {
+				n = x2;
+				continue;
+			}
+
+			*start = x1;
+			*end = x2;
+			*href = "mailto:" + link;
+			return true;
 		}
 	}
 
-	QString out = p.output();
+	return false;
+}
+
+/**
+ * Formats a plain text message body for display, following the rules of
+ * plain2rich(), linkify(), emoticonify() and legacyFormat() but walking
+ * the text only once instead of re-parsing the result of each step.
+ */
+QString TextUtil::formatMessage(const QString &plain, bool emoticons, bool legacyFormatting)
+{
+	const EmoticonMatcher *matcher = emoticons ? &PsiIconset::instance()->emoticonMatcher() : 0;
+
+	QString out;
+	out.reserve(plain.length() + plain.length() / 4 + 64);
+	out += "<span style='white-space: pre-wrap'>";
+
+	int at = 0, start, end;
+	QString href;
+	while(format_findLink(plain, at, &start, &end, &href)) {
+		format_text(&out, plain, at, start, matcher, legacyFormatting);
+		out += QString("<a href=\"%1\">").arg(href) + Qt::escape(plain.mid(start, end - start)) + "</a>";
+		at = end;
+	}
+	format_text(&out, plain, at, plain.length(), matcher, legacyFormatting);
+
+	out += "</span>";
 	return out;
 }
 
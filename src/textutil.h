@@ -15,6 +15,7 @@ namespace TextUtil
 	QString linkify(const QString &);
 	QString legacyFormat(const QString &);
 	QString emoticonify(const QString &in);
+	QString formatMessage(const QString &plain, bool emoticons, bool legacyFormatting);
 };
 
 #endif
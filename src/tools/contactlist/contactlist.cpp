@@ -2,10 +2,11 @@
 #include "contactlistgroupitem.h"
 #include "contactlistrootitem.h"
 #include "contactlistalphacomparator.h"
+#include "contactlistsearch.h"
 
 
 ContactList::ContactList(QObject* parent)
-	: QObject(parent), showOffline_(false), showGroups_(true)
+	: QObject(parent), showOffline_(false), showGroups_(true), updatingParents_(false)
 {
 	rootItem_ = new ContactListRootItem(this);
 	invisibleGroup_ = new ContactListRootItem(this);
@@ -41,22 +42,16 @@ void ContactList::setShowGroups(bool showGroups)
 
 void ContactList::setSearch(const QString& search)
 {
-	QString oldSearch = search_;
+	ContactListSearch::Change change = ContactListSearch::change(search_, search);
 	search_ = search;
 
-	if ((oldSearch.isEmpty() && !search.isEmpty()) || search.isEmpty()) {
-		updateParents();
-	}
-	if (search.isEmpty()) {
-		updateParents();
-	}
-	else if (search.startsWith(oldSearch)) {
+	if (change == ContactListSearch::Narrowed) {
 		updateVisibleParents();
 	}
-	else if (oldSearch.startsWith(search)) {
+	else if (change == ContactListSearch::Widened) {
 		updateInvisibleParents();
 	}
-	else {
+	else if (change == ContactListSearch::Replaced) {
 		updateParents();
 	}
 }
@@ -101,15 +96,21 @@ ContactListGroupItem* ContactList::conferenceGroup()
 	return conferenceGroup_;
 }*/
 
+// The update*Parents() functions may move every item around, so they
+// don't report single items but let the model reset once at the end.
 void ContactList::updateVisibleParents()
 {
+	updatingParents_ = true;
 	rootItem()->updateParents();
+	updatingParents_ = false;
 	emit dataChanged();
 }
 
 void ContactList::updateInvisibleParents()
 {
+	updatingParents_ = true;
 	invisibleGroup()->updateParents();
+	updatingParents_ = false;
 	emit dataChanged();
 }
 
@@ -121,8 +122,10 @@ void ContactList::updateParents()
 	altInvisibleGroup_ = tmpInvisibleGroup;
 
 	// Move items around
+	updatingParents_ = true;
 	rootItem()->updateParents();
 	altInvisibleGroup_->updateParents();
+	updatingParents_ = false;
 
 	emit dataChanged();
 }
@@ -3,6 +3,7 @@
 
 #include <QObject>
 
+class ContactListItem;
 class ContactListGroupItem;
 class ContactListRootItem;
 class ContactListItemComparator;
@@ -12,6 +13,8 @@ class ContactList : public QObject
 	Q_OBJECT
 
 	friend class ContactListModel;
+	friend class ContactListItem;
+	friend class ContactListGroupItem;
 
 public:
 	ContactList(QObject* parent = 0);
@@ -24,6 +27,11 @@ public:
 
 signals:
 	void dataChanged();
+	void itemToBeAdded(ContactListGroupItem* parent, int index);
+	void itemAdded(ContactListGroupItem* parent, int index);
+	void itemToBeRemoved(ContactListGroupItem* parent, int index);
+	void itemRemoved(ContactListGroupItem* parent, int index);
+	void itemChanged(ContactListItem* item);
 
 public slots:
 	void setShowOffline(bool);
@@ -35,6 +43,7 @@ protected:
 	void updateParents();
 	void updateVisibleParents();
 	void updateInvisibleParents();
+	bool itemSignalsEnabled() const { return !updatingParents_; }
 
 	//ContactListGroupItem* hiddenGroup();
 	//ContactListGroupItem* agentsGroup();
@@ -42,6 +51,7 @@ protected:
 
 private:
 	bool showOffline_, showGroups_;
+	bool updatingParents_;
 	QString search_;
 	ContactListItemComparator* itemComparator_;
 
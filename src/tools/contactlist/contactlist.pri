@@ -10,6 +10,7 @@ HEADERS += \
 	$$PWD/contactlistalphacomparator.h \
 	$$PWD/contactlist.h \
 	$$PWD/contactlistmodel.h \
+	$$PWD/contactlistsearch.h \
 	$$PWD/contactlistview.h \
 	$$PWD/status.h
 
@@ -1,12 +1,18 @@
 #include <QList>
+#include <QtAlgorithms>
 
 #include "contactlist.h"
 #include "contactlistrootitem.h"
 #include "contactlistgroupitem.h"
 #include "contactlistitemcomparator.h"
 
-ContactListGroupItem::ContactListGroupItem(ContactListGroupItem* parent) : ContactListItem(parent)
+ContactListGroupItem::ContactListGroupItem(ContactListGroupItem* parent) : ContactListItem(parent), count_(0), countOnline_(0)
 {
+	// ContactListItem() added this to the parent before it was a group
+	if (this->parent()) {
+		this->parent()->updateCounts(-counted_, -countedOnline_);
+		counted_ = countedOnline_ = 0;
+	}
 }
 
 ContactListGroupItem::~ContactListGroupItem()
@@ -33,31 +39,105 @@ int ContactListGroupItem::items() const
 	return items_.size();
 }
 
-void ContactListGroupItem::addItem(ContactListItem* item)
+class ItemLessThan
 {
-	QList<ContactListItem*>::Iterator it = items_.begin();
-	bool inserted = false;
-	while(it != items_.end() && !inserted) {
-		if (contactList()->itemComparator()->compare(*it,item) >= 0) {
-			items_.insert(it,item);
-			inserted = true;
-		}
-		it++;
+public:
+	ItemLessThan(const ContactListItemComparator* comparator) : comparator_(comparator) { }
+	bool operator()(ContactListItem* it1, ContactListItem* it2) const {
+		return comparator_->compare(it1,it2) < 0;
 	}
 
-	if (!inserted) {
-		items_.push_back(item);
-	}
+private:
+	const ContactListItemComparator* comparator_;
+};
+
+int ContactListGroupItem::insertPosition(ContactListItem* item) const
+{
+	// Before the first item that doesn't sort before the new one
+	return qLowerBound(items_.begin(), items_.end(), item, ItemLessThan(contactList()->itemComparator())) - items_.begin();
+}
+
+void ContactListGroupItem::addItem(ContactListItem* item)
+{
+	ContactList* list = contactList();
+	int index = insertPosition(item);
+
+	if (list->itemSignalsEnabled())
+		emit list->itemToBeAdded(this, index);
+	items_.insert(index, item);
+	item->counted_ = item->count();
+	item->countedOnline_ = item->countOnline();
+	updateCounts(item->counted_, item->countedOnline_);
+	if (list->itemSignalsEnabled())
+		emit list->itemAdded(this, index);
 
 	updateParent();
 }
 
 void ContactListGroupItem::removeItem(ContactListItem* item)
 {
-	items_.removeAll(item);
+	ContactList* list = contactList();
+	int index = items_.indexOf(item);
+	if (index < 0)
+		return;
+
+	if (list->itemSignalsEnabled())
+		emit list->itemToBeRemoved(this, index);
+	items_.removeAt(index);
+	updateCounts(-item->counted_, -item->countedOnline_);
+	if (list->itemSignalsEnabled())
+		emit list->itemRemoved(this, index);
+
 	updateParent();
 }
 
+void ContactListGroupItem::updateItem(ContactListItem* item)
+{
+	ContactList* list = contactList();
+	int index = items_.indexOf(item);
+	if (index < 0)
+		return;
+
+	int count = item->count();
+	int online = item->countOnline();
+	if (count != item->counted_ || online != item->countedOnline_) {
+		updateCounts(count - item->counted_, online - item->countedOnline_);
+		item->counted_ = count;
+		item->countedOnline_ = online;
+	}
+
+	// Move the item if its sort key changed
+	const ContactListItemComparator* comparator = list->itemComparator();
+	if ((index > 0 && comparator->compare(items_.at(index - 1), item) > 0) ||
+	    (index < items_.size() - 1 && comparator->compare(item, items_.at(index + 1)) > 0)) {
+		if (list->itemSignalsEnabled())
+			emit list->itemToBeRemoved(this, index);
+		items_.removeAt(index);
+		if (list->itemSignalsEnabled())
+			emit list->itemRemoved(this, index);
+
+		index = insertPosition(item);
+		if (list->itemSignalsEnabled())
+			emit list->itemToBeAdded(this, index);
+		items_.insert(index, item);
+		if (list->itemSignalsEnabled())
+			emit list->itemAdded(this, index);
+	}
+
+	if (list->itemSignalsEnabled())
+		emit list->itemChanged(item);
+}
+
+void ContactListGroupItem::updateCounts(int count, int countOnline)
+{
+	count_ += count;
+	countOnline_ += countOnline;
+	counted_ += count;
+	countedOnline_ += countOnline;
+	if (parent())
+		parent()->updateCounts(count, countOnline);
+}
+
 ContactListItem* ContactListGroupItem::findFirstItem(ContactListItem* other)
 {
 	if (equals(other)) {
@@ -81,20 +161,12 @@ bool ContactListGroupItem::expanded() const
 
 int ContactListGroupItem::count() const
 {
-	int count = 0;
-	for (int i = 0; i < items_.size(); ++i) {
-		count += items_.at(i)->count();
-	}
-	return count;
+	return count_;
 }
 
 int ContactListGroupItem::countOnline() const
 {
-	int count = 0;
-	for (int i = 0; i < items_.size(); ++i) {
-		count += items_.at(i)->countOnline();
-	}
-	return count;
+	return countOnline_;
 }
 
 void ContactListGroupItem::updateParent()
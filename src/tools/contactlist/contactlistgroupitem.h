@@ -17,6 +17,7 @@ public:
 	int items() const;
 	void addItem(ContactListItem*);
 	void removeItem(ContactListItem*);
+	void updateItem(ContactListItem*);
 	virtual bool expanded() const;
 	virtual ContactListItem* findFirstItem(ContactListItem*);
 	virtual int count() const;
@@ -27,7 +28,11 @@ public:
 	//virtual QList<ContactListItem*> invisibleItems();
 
 private:
+	int insertPosition(ContactListItem*) const;
+	void updateCounts(int count, int countOnline);
+
 	QList<ContactListItem*> items_;
+	int count_, countOnline_;
 };
 
 #endif
@@ -2,7 +2,7 @@
 #include "contactlistitem.h"
 #include "contactlistgroupitem.h"
 
-ContactListItem::ContactListItem(ContactListGroupItem* parent) : parent_(NULL), defaultParent_(parent)
+ContactListItem::ContactListItem(ContactListGroupItem* parent) : parent_(NULL), defaultParent_(parent), counted_(0), countedOnline_(0)
 {
 	setParent(parent);
 }
@@ -35,12 +35,25 @@ void ContactListItem::setParent(ContactListGroupItem* parent)
 			parent_->removeItem(this);
 		}
 		
-		if (parent) {
-			parent->addItem(this);
-		}
-		
+		// Set the parent first, so the item can be looked up while it is added
 		parent_ = parent;
-		contactList()->emitDataChanged();
+
+		if (parent_) {
+			parent_->addItem(this);
+		}
+	}
+}
+
+void ContactListItem::itemChanged()
+{
+	ContactListGroupItem* oldParent = parent();
+	if (!oldParent)
+		return;
+
+	// The change may hide or show the item
+	updateParent();
+	if (parent() == oldParent) {
+		parent()->updateItem(this);
 	}
 }
 
@@ -11,6 +11,8 @@ class QMenu;
 
 class ContactListItem
 {
+	friend class ContactListGroupItem;
+
 public:
 	ContactListItem(ContactListGroupItem* parent);
 	virtual ~ContactListItem() {};
@@ -35,10 +37,15 @@ public:
 	virtual void setParent(ContactListGroupItem* parent);
 	virtual void showContextMenu(const QPoint&);
 
+	// To be called when the data shown for the item changed
+	void itemChanged();
+
 
 private:
 	ContactListGroupItem* parent_;
 	ContactListGroupItem* defaultParent_;
+	// count() and countOnline() as included in the counts of the parent
+	int counted_, countedOnline_;
 };
 
 #endif
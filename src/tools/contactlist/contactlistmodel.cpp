@@ -24,6 +24,11 @@
 ContactListModel::ContactListModel(ContactList* contactList) : contactList_(contactList), showStatus_(true)
 {
 	connect(contactList_,SIGNAL(dataChanged()),this,SLOT(contactList_changed()));
+	connect(contactList_,SIGNAL(itemToBeAdded(ContactListGroupItem*,int)),this,SLOT(contactList_itemToBeAdded(ContactListGroupItem*,int)));
+	connect(contactList_,SIGNAL(itemAdded(ContactListGroupItem*,int)),this,SLOT(contactList_itemAdded(ContactListGroupItem*,int)));
+	connect(contactList_,SIGNAL(itemToBeRemoved(ContactListGroupItem*,int)),this,SLOT(contactList_itemToBeRemoved(ContactListGroupItem*,int)));
+	connect(contactList_,SIGNAL(itemRemoved(ContactListGroupItem*,int)),this,SLOT(contactList_itemRemoved(ContactListGroupItem*,int)));
+	connect(contactList_,SIGNAL(itemChanged(ContactListItem*)),this,SLOT(contactList_itemChanged(ContactListItem*)));
 }
 
 
@@ -185,7 +190,68 @@ Qt::ItemFlags ContactListModel::flags(const QModelIndex& index) const
 }
 
 
+bool ContactListModel::isShown(ContactListItem* item) const
+{
+	// Items in the invisible groups are not part of the model
+	while (item && item != contactList_->rootItem())
+		item = item->parent();
+	return item != 0;
+}
+
+QModelIndex ContactListModel::itemIndex(ContactListItem* item, int column) const
+{
+	if (item == contactList_->rootItem())
+		return QModelIndex();
+	return createIndex(item->index(),column,item);
+}
+
+void ContactListModel::updateGroupCounts(ContactListGroupItem* group)
+{
+	// The name of each group includes the number of contacts in it
+	while (group && group != contactList_->rootItem()) {
+		QModelIndex index = itemIndex(group,NameColumn);
+		emit dataChanged(index,index);
+		group = group->parent();
+	}
+}
+
 void ContactListModel::contactList_changed()
 {
 	reset();
 }
+
+void ContactListModel::contactList_itemToBeAdded(ContactListGroupItem* parent, int index)
+{
+	if (isShown(parent))
+		beginInsertRows(itemIndex(parent),index,index);
+}
+
+void ContactListModel::contactList_itemAdded(ContactListGroupItem* parent, int)
+{
+	if (isShown(parent)) {
+		endInsertRows();
+		updateGroupCounts(parent);
+	}
+}
+
+void ContactListModel::contactList_itemToBeRemoved(ContactListGroupItem* parent, int index)
+{
+	if (isShown(parent))
+		beginRemoveRows(itemIndex(parent),index,index);
+}
+
+void ContactListModel::contactList_itemRemoved(ContactListGroupItem* parent, int)
+{
+	if (isShown(parent)) {
+		endRemoveRows();
+		updateGroupCounts(parent);
+	}
+}
+
+void ContactListModel::contactList_itemChanged(ContactListItem* item)
+{
+	if (isShown(item)) {
+		emit dataChanged(itemIndex(item,0),itemIndex(item,COLUMNS-1));
+		updateGroupCounts(item->parent());
+	}
+}
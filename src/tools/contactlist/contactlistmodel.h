@@ -6,6 +6,8 @@
 #include <QVariant>
 
 class ContactList;
+class ContactListItem;
+class ContactListGroupItem;
 
 class ContactListModel : public QAbstractItemModel
 {
@@ -36,8 +38,17 @@ public:
 
 protected slots:
 	void contactList_changed();
+	void contactList_itemToBeAdded(ContactListGroupItem* parent, int index);
+	void contactList_itemAdded(ContactListGroupItem* parent, int index);
+	void contactList_itemToBeRemoved(ContactListGroupItem* parent, int index);
+	void contactList_itemRemoved(ContactListGroupItem* parent, int index);
+	void contactList_itemChanged(ContactListItem* item);
 
 private:
+	bool isShown(ContactListItem* item) const;
+	QModelIndex itemIndex(ContactListItem* item, int column = 0) const;
+	void updateGroupCounts(ContactListGroupItem* group);
+
 	ContactList* contactList_;
 	bool showStatus_;
 };
@@ -0,0 +1,29 @@
+#ifndef CONTACTLISTSEARCH_H
+#define CONTACTLISTSEARCH_H
+
+#include <QString>
+
+class ContactListSearch
+{
+public:
+	enum Change { Unchanged, Narrowed, Widened, Replaced };
+
+	// Tells which items may change visibility when the search changes.
+	// A narrowed search can only hide matching items, a widened one can
+	// only show hidden items. An empty search matches in a different way
+	// (e.g. offline contacts), so going from or to it replaces the search.
+	static Change change(const QString& oldSearch, const QString& newSearch) {
+		if (newSearch == oldSearch)
+			return Unchanged;
+		else if (oldSearch.isEmpty() || newSearch.isEmpty())
+			return Replaced;
+		else if (newSearch.startsWith(oldSearch))
+			return Narrowed;
+		else if (oldSearch.startsWith(newSearch))
+			return Widened;
+		else
+			return Replaced;
+	}
+};
+
+#endif
@@ -17,7 +17,7 @@ public:
 		else
 			picture_ = QIcon(pic);
 
-		updateParent();
+		itemChanged();
 	}
 
 	virtual const QString& name() const { return name_; }
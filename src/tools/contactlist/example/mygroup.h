@@ -8,7 +8,9 @@
 class MyGroup : public ContactListGroup
 {
 public:
-	MyGroup(const QString& name, ContactListGroupItem* parent = 0) : ContactListGroup(parent), name_(name) { }
+	MyGroup(const QString& name, ContactListGroupItem* parent = 0) : ContactListGroup(parent), name_(name) {
+		itemChanged();
+	}
 	virtual const QString& name() const { return name_; }
 
 	bool expanded() const {
@@ -24,6 +24,14 @@
 #include <QFile>
 #include <QFileInfo>
 #include <QTimer>
+#include <QBuffer>
+#include <QImage>
+#include <QImageReader>
+#include <QImageIOHandler>
+#include <QMutex>
+#include <QPair>
+#include <QSet>
+#include <QtAlgorithms>
 
 #include <QIcon>
 #include <QRegExp>
@@ -207,6 +215,51 @@ private:
 
 static IconSharedObject *iconSharedObject = 0;
 
+//----------------------------------------------------------------------------
+// DecodedIconCache
+//----------------------------------------------------------------------------
+
+// maximal number of on-demand decoded icons that are kept in memory
+#define ICONSET_DECODED_LIMIT 512
+
+/**
+ * Keeps track of the icons that were decoded on demand from their compressed
+ * data, and unloads the least recently used ones once there are more than
+ * ICONSET_DECODED_LIMIT of them. Unloading happens from the event loop, so
+ * the references returned by PsiIcon::pixmap() and friends stay valid for
+ * the rest of the current call chain.
+ */
+class DecodedIconCache : public QObject
+{
+	Q_OBJECT
+public:
+	static DecodedIconCache *instance();
+
+	void insert(PsiIcon::Private *);
+	void remove(PsiIcon::Private *);
+
+private slots:
+	void trim();
+
+private:
+	DecodedIconCache();
+
+	static DecodedIconCache *instance_;
+	QMutex mutex_;
+	QSet<PsiIcon::Private *> icons_;
+	bool trimPending_;
+};
+
+// icons are used by both the GUI thread and the iconset loader thread
+static QMutex iconUseMutex;
+static quint32 iconUseClock = 0;
+
+static quint32 nextIconUse()
+{
+	QMutexLocker locker(&iconUseMutex);
+	return ++iconUseClock;
+}
+
 //----------------------------------------------------------------------------
 // PsiIcon
 //----------------------------------------------------------------------------
@@ -236,10 +289,19 @@ public:
 		anim = 0;
 		icon = 0;
 		activatedCount = 0;
+
+		dataIsAnim = false;
+		animRemoved = false;
+		pending = false;
+		strippedFrames = 0;
+		lastUse = 0;
 	}
 
 	~Private()
 	{
+		if ( !data.isEmpty() )
+			DecodedIconCache::instance()->remove(this);
+
 		unloadAnim();
 		if ( icon )
 			delete icon;
@@ -258,6 +320,16 @@ public:
 		impix = from.impix;
 		anim = from.anim ? new Anim ( *from.anim ) : 0;
 		icon = 0;
+		activatedCount = 0;
+
+		data = from.data;
+		dataIsAnim = from.dataIsAnim;
+		animRemoved = from.animRemoved;
+		pending = from.pending;
+		strippedFrames = from.strippedFrames;
+		lastUse = from.lastUse;
+		if ( !data.isEmpty() && !pending )
+			DecodedIconCache::instance()->insert(this);
 	}
 	
 	void unloadAnim()
@@ -266,6 +338,73 @@ public:
 			delete anim;
 		anim = 0;
 	}
+
+	/**
+	 * Decodes the compressed data the same way the eager loader used to:
+	 * animations with less than two frames become plain images.
+	 */
+	void decode()
+	{
+		pending = false;
+
+		if ( dataIsAnim ) {
+			Anim a(data);
+			if ( a.numFrames() > 0 )
+				impix = a.frame(0);
+
+			if ( a.numFrames() > 1 && !animRemoved ) {
+				anim = new Anim(a);
+				for ( int i = 0; i < strippedFrames; i++ )
+					anim->stripFirstFrame();
+			}
+		}
+
+		if ( impix.isNull() )
+			impix.loadFromData(data);
+
+		DecodedIconCache::instance()->insert(this);
+	}
+
+	/**
+	 * Must be called before accessing the image data.
+	 */
+	void use()
+	{
+		if ( pending )
+			decode();
+		if ( !data.isEmpty() )
+			lastUse = nextIconUse();
+	}
+
+	/**
+	 * Frees the decoded images, they'll be decoded again on next use().
+	 * Called by DecodedIconCache only.
+	 */
+	void unloadDecoded()
+	{
+		impix = Impix();
+		unloadAnim();
+		if ( icon )
+			delete icon;
+		icon = 0;
+		pending = true;
+	}
+
+	/**
+	 * Forgets the compressed data, e.g. when the image is replaced explicitly.
+	 */
+	void dropData()
+	{
+		if ( data.isEmpty() )
+			return;
+
+		use();
+		DecodedIconCache::instance()->remove(this);
+		data = QByteArray();
+		dataIsAnim = false;
+		animRemoved = false;
+		strippedFrames = 0;
+	}
 	
 	void connectInstance(PsiIcon *icon)
 	{
@@ -305,10 +444,76 @@ public:
 	QIconSet *icon;
 
 	int activatedCount;
+
+	QByteArray data;      // compressed image, decoded on first use()
+	bool dataIsAnim;
+	bool animRemoved;     // decode only the first frame of the animation
+	bool pending;         // data is not decoded yet
+	int strippedFrames;   // stripFirstAnimFrame() calls to replay after decoding
+	quint32 lastUse;
+
 	friend class PsiIcon;
 };
 //! \endif
 
+DecodedIconCache *DecodedIconCache::instance_ = 0;
+
+DecodedIconCache::DecodedIconCache()
+	: QObject(0)
+	, trimPending_(false)
+{
+	moveToMainThread(this);
+}
+
+DecodedIconCache *DecodedIconCache::instance()
+{
+	if ( !instance_ )
+		instance_ = new DecodedIconCache();
+	return instance_;
+}
+
+void DecodedIconCache::insert(PsiIcon::Private *icon)
+{
+	QMutexLocker locker(&mutex_);
+	icons_.insert(icon);
+
+	if ( icons_.count() > ICONSET_DECODED_LIMIT && !trimPending_ ) {
+		trimPending_ = true;
+		QMetaObject::invokeMethod(this, "trim", Qt::QueuedConnection);
+	}
+}
+
+void DecodedIconCache::remove(PsiIcon::Private *icon)
+{
+	QMutexLocker locker(&mutex_);
+	icons_.remove(icon);
+}
+
+void DecodedIconCache::trim()
+{
+	QMutexLocker locker(&mutex_);
+	trimPending_ = false;
+
+	if ( icons_.count() <= ICONSET_DECODED_LIMIT )
+		return;
+
+	// unload down to three quarters of the limit, so that we don't
+	// have to do this again after every single decoded icon
+	int excess = icons_.count() - ICONSET_DECODED_LIMIT * 3 / 4;
+
+	// running animations are never unloaded
+	QList< QPair<quint32, PsiIcon::Private *> > lru;
+	foreach(PsiIcon::Private *icon, icons_)
+		if ( icon->activatedCount == 0 )
+			lru << qMakePair(icon->lastUse, icon);
+	qSort(lru);
+
+	for ( int i = 0; i < lru.count() && i < excess; i++ ) {
+		icons_.remove(lru[i].second);
+		lru[i].second->unloadDecoded();
+	}
+}
+
 /**
  * Constructs empty PsiIcon.
  */
@@ -385,6 +590,7 @@ void PsiIcon::detach()
  */
 bool PsiIcon::isAnimated() const
 {
+	d->use();
 	return d->anim != 0;
 }
 
@@ -393,6 +599,7 @@ bool PsiIcon::isAnimated() const
  */
 const QPixmap &PsiIcon::pixmap() const
 {
+	d->use();
 	return d->pixmap();
 }
 
@@ -401,6 +608,7 @@ const QPixmap &PsiIcon::pixmap() const
  */
 const QImage &PsiIcon::image() const
 {
+	d->use();
 	if ( d->anim )
 		return d->anim->frameImage();
 	return d->impix.image();
@@ -412,6 +620,7 @@ const QImage &PsiIcon::image() const
  */
 const Impix &PsiIcon::impix() const
 {
+	d->use();
 	return d->impix;
 }
 
@@ -421,6 +630,7 @@ const Impix &PsiIcon::impix() const
  */
 const Impix &PsiIcon::frameImpix() const
 {
+	d->use();
 	if ( d->anim )
 		return d->anim->frameImpix();
 	return d->impix;
@@ -432,6 +642,7 @@ const Impix &PsiIcon::frameImpix() const
  */
 const QIcon &PsiIcon::icon() const
 {
+	d->use();
 	if ( d->icon )
 		return *d->icon;
 
@@ -448,6 +659,7 @@ void PsiIcon::setImpix(const Impix &impix, bool doDetach)
 	if ( doDetach )
 		detach();
 
+	d->dropData();
 	d->impix = impix;
 	if ( d->icon ) {
 		delete d->icon;
@@ -463,6 +675,7 @@ void PsiIcon::setImpix(const Impix &impix, bool doDetach)
  */
 const Anim *PsiIcon::anim() const
 {
+	d->use();
 	return d->anim;
 }
 
@@ -476,6 +689,7 @@ void PsiIcon::setAnim(const Anim &anim, bool doDetach)
 	if ( doDetach )
 		detach();
 
+	d->dropData();
 	d->unloadAnim();
 	d->anim = new Anim(anim);
 
@@ -505,6 +719,8 @@ void PsiIcon::removeAnim(bool doDetach)
 	if ( doDetach )
 		detach();
 
+	// the compressed data is kept, it just won't be decoded as animation
+	d->animRemoved = true;
 	if ( !d->anim )
 		return;
 
@@ -524,6 +740,7 @@ void PsiIcon::removeAnim(bool doDetach)
  */
 int PsiIcon::frameNumber() const
 {
+	d->use();
 	if ( d->anim )
 		return d->anim->frameNumber();
 
@@ -663,29 +880,52 @@ bool PsiIcon::blockSignals(bool b)
 
 /**
  * Initializes PsiIcon's Impix (or Anim, if \a isAnim equals \c true).
- * Iconset::load uses this function.
+ * Iconset::load uses this function. Only the image header is decoded
+ * here, \a ba itself is decoded when the icon is first used, and may be
+ * unloaded again when it wasn't used for a long time.
  */
 bool PsiIcon::loadFromData(const QByteArray &ba, bool isAnim)
 {
 	detach();
 
-	bool ret = false;
-	if ( isAnim ) {
-		Anim *anim = new Anim(ba);
-		setAnim(*anim);
-		ret = anim->numFrames() > 0;
-		delete anim; // shared data rules ;)
+	QBuffer buffer((QByteArray *)&ba);
+	buffer.open(QBuffer::ReadOnly);
+	QImageReader reader(&buffer);
+	if ( !reader.canRead() )
+		return false;
+	// make sure the header can be decoded, formats that can't tell their
+	// size without decoding the image are decoded completely
+	if ( reader.supportsOption(QImageIOHandler::Size) ) {
+		if ( !reader.size().isValid() )
+			return false;
+	}
+	else if ( QImage::fromData(ba).isNull() ) {
+		return false;
 	}
 
-	if ( !ret && d->impix.loadFromData(ba) )
-		ret = true;
+	d->dropData();
+	d->impix = Impix();
+	d->unloadAnim();
+	if ( d->icon ) {
+		delete d->icon;
+		d->icon = 0;
+	}
 
-	if ( ret ) {
-		emit d->pixmapChanged();
-		emit d->iconModified();
+	d->data = ba;
+	d->dataIsAnim = isAnim;
+	d->animRemoved = false;
+	d->strippedFrames = 0;
+	d->pending = true;
+
+	if ( d->activatedCount > 0 ) {
+		d->activatedCount = 0;
+		activated(false); // restart the animation, but don't play the sound
 	}
 
-	return ret;
+	emit d->pixmapChanged();
+	emit d->iconModified();
+
+	return true;
 }
 
 /**
@@ -713,6 +953,7 @@ void PsiIcon::activated(bool playSound)
 	Q_UNUSED(iconSharedObject);
 #endif
 
+	d->use();
 	if ( d->anim ) {
 		d->anim->unpause();
 
@@ -748,8 +989,12 @@ void PsiIcon::stop()
 void PsiIcon::stripFirstAnimFrame()
 {
 	detach();
-	
-	if ( d->anim )
+
+	// remember it, so that the frame is stripped after (re)decoding as well
+	if ( d->dataIsAnim )
+		d->strippedFrames++;
+
+	if ( !d->pending && d->anim )
 		d->anim->stripFirstFrame();
 }
 
@@ -775,6 +1020,7 @@ private:
 		: QObject(QCoreApplication::instance())
 		, iconsets_(0)
 		, emptyPixmap_(0)
+		, indexDirty_(false)
 	{
 	}
 
@@ -797,6 +1043,15 @@ private:
 	QList<Iconset*>* iconsets_;
 	mutable QPixmap* emptyPixmap_;
 
+	// merged index of all registered iconsets, the icon of the
+	// earliest registered iconset wins when names collide
+	mutable QHash<QString, const PsiIcon*> index_;
+	mutable bool indexDirty_;
+
+	const PsiIcon *lookup(const QString &name) const;
+	void addToIndex(const Iconset *) const;
+	void rebuildIndex() const;
+
 public:
 	const QPixmap& emptyPixmap() const
 	{
@@ -821,6 +1076,7 @@ public:
 
 	void registerIconset(const Iconset *);
 	void unregisterIconset(const Iconset *);
+	void iconsetChanged(const Iconset *);
 
 public:
 	static IconsetFactoryPrivate* instance()
@@ -842,17 +1098,51 @@ void IconsetFactoryPrivate::registerIconset(const Iconset *i)
 	if (!iconsets_)
 		iconsets_ = new QList<Iconset*>;
 
-	if (!iconsets_->contains((Iconset*)i))
-		iconsets_->append((Iconset*)i);
+	if (iconsets_->contains((Iconset*)i))
+		return;
+
+	iconsets_->append((Iconset*)i);
+
+	// the new iconset has the lowest precedence
+	if (!indexDirty_)
+		addToIndex(i);
 }
 
 void IconsetFactoryPrivate::unregisterIconset(const Iconset *i)
+{
+	if (!iconsets_ || !iconsets_->contains((Iconset*)i))
+		return;
+
+	iconsets_->removeAll((Iconset*)i);
+
+	// names that were provided by this iconset fall back
+	// to the remaining iconsets
+	if (!indexDirty_) {
+		QHashIterator<QString, PsiIcon *> it(i->iconDict());
+		while (it.hasNext()) {
+			it.next();
+			if (!it.value() || index_.value(it.key()) != it.value())
+				continue;
+
+			const PsiIcon *other = lookup(it.key());
+			if (other)
+				index_.insert(it.key(), other);
+			else
+				index_.remove(it.key());
+		}
+	}
+}
+
+/**
+ * Must be called whenever the contents of the Iconset \a i change.
+ */
+void IconsetFactoryPrivate::iconsetChanged(const Iconset *i)
 {
 	if (iconsets_ && iconsets_->contains((Iconset*)i))
-		iconsets_->removeAll((Iconset*)i);
+		indexDirty_ = true;
 }
 
-const PsiIcon *IconsetFactoryPrivate::icon(const QString &name) const
+const PsiIcon *IconsetFactoryPrivate::lookup(const QString &name) const
 {
 	if (!iconsets_)
 		return 0;
@@ -869,6 +1159,41 @@ const PsiIcon *IconsetFactoryPrivate::icon(const QString &name) const
 	return i;
 }
 
+/**
+ * Indexes the names of \a i that aren't provided by an iconset
+ * with higher precedence yet.
+ */
+void IconsetFactoryPrivate::addToIndex(const Iconset *i) const
+{
+	QHashIterator<QString, PsiIcon *> it(i->iconDict());
+	while (it.hasNext()) {
+		it.next();
+		if (it.value() && !index_.contains(it.key()))
+			index_.insert(it.key(), it.value());
+	}
+}
+
+void IconsetFactoryPrivate::rebuildIndex() const
+{
+	index_.clear();
+	indexDirty_ = false;
+
+	if (!iconsets_)
+		return;
+
+	Iconset *iconset;
+	foreach (iconset, *iconsets_)
+		addToIndex(iconset);
+}
+
+const PsiIcon *IconsetFactoryPrivate::icon(const QString &name) const
+{
+	if (indexDirty_)
+		rebuildIndex();
+
+	return index_.value(name);
+}
+
 /**
  * Returns pointer to PsiIcon with name \a name, or \a 0 if PsiIcon with that name wasn't
  * found in IconsetFactory.
@@ -945,6 +1270,9 @@ private:
 		//authors << "I. M. Anonymous";
 		//creation = "1900-01-01";
 		homeUrl = QString::null;
+#ifdef ICONSET_ZIP
+		zip = 0;
+#endif
 	}
 
 public:
@@ -953,6 +1281,9 @@ public:
 	QHash<QString, PsiIcon *> dict; // unsorted hash for fast search
 	QList<PsiIcon *> list;          // sorted list
 	QHash<QString, QString> info;
+#ifdef ICONSET_ZIP
+	UnZip *zip; // archive kept open for the duration of Iconset::load()
+#endif
 
 public:
 	Private()
@@ -977,6 +1308,9 @@ public:
 	~Private()
 	{
 		clear();
+#ifdef ICONSET_ZIP
+		closeArchive();
+#endif
 	}
 
 	void append(QString n, PsiIcon *icon)
@@ -1020,14 +1354,18 @@ public:
 		}
 #ifdef ICONSET_ZIP
 		else if ( fi.extension(false) == "jisp" || fi.extension(false) == "zip" ) {
-			UnZip z(dir);
-			if ( !z.open() )
-				return ba;
+			UnZip tmp(dir);
+			UnZip *z = zip;
+			if ( !z || z->name() != dir ) {
+				z = &tmp;
+				if ( !z->open() )
+					return ba;
+			}
 
 			QString n = fi.baseName(true) + "/" + fileName;
-			if ( !z.readFile(n, &ba) ) {
+			if ( !z->readFile(n, &ba) ) {
 				n = "/" + fileName;
-				z.readFile(n, &ba);
+				z->readFile(n, &ba);
 			}
 		}
 #endif
@@ -1035,6 +1373,32 @@ public:
 		return ba;
 	}
 
+#ifdef ICONSET_ZIP
+	/**
+	 * Opens the archive \a dir once, so that all subsequent loadData()
+	 * calls stream from the same handle and its central directory index
+	 * instead of reopening and rescanning the file for every member.
+	 */
+	void openArchive(const QString &dir)
+	{
+		closeArchive();
+
+		QFileInfo fi(dir);
+		if ( fi.isDir() || (fi.extension(false) != "jisp" && fi.extension(false) != "zip") )
+			return;
+
+		zip = new UnZip(dir);
+		if ( !zip->open() )
+			closeArchive();
+	}
+
+	void closeArchive()
+	{
+		delete zip;
+		zip = 0;
+	}
+#endif
+
 	void loadMeta(const QDomElement &i, const QString &dir)
 	{
 		Q_UNUSED(dir);
@@ -1316,6 +1680,7 @@ Iconset::Iconset()
 	//iconset_counter++;
 
 	d = new Private;
+	registered_ = false;
 }
 
 /**
@@ -1327,6 +1692,7 @@ Iconset::Iconset(const Iconset &from)
 
 	d = from.d;
 	d->ref();
+	registered_ = false;
 }
 
 /**
@@ -1334,7 +1700,8 @@ Iconset::Iconset(const Iconset &from)
  */
 Iconset::~Iconset()
 {
-	IconsetFactoryPrivate::instance()->unregisterIconset(this);
+	if ( registered_ )
+		IconsetFactoryPrivate::instance()->unregisterIconset(this);
 
 	if ( d->deref() )
 		delete d;
@@ -1351,6 +1718,9 @@ Iconset &Iconset::operator=(const Iconset &from)
 	d = from.d;
 	d->ref();
 
+	if ( registered_ )
+		IconsetFactoryPrivate::instance()->iconsetChanged(this);
+
 	return *this;
 }
 
@@ -1382,6 +1752,9 @@ Iconset &Iconset::operator+=(const Iconset &i)
 		d->append( icon->name(), icon );
 	}
 
+	if ( registered_ )
+		IconsetFactoryPrivate::instance()->iconsetChanged(this);
+
 	return *this;
 }
 
@@ -1393,6 +1766,8 @@ void Iconset::clear()
 	detach();
 
 	d->clear();
+	if ( registered_ )
+		IconsetFactoryPrivate::instance()->iconsetChanged(this);
 }
 
 /**
@@ -1417,6 +1792,10 @@ bool Iconset::load(const QString &dir)
 
 	bool ret = false;
 
+#ifdef ICONSET_ZIP
+	d->openArchive(dir);
+#endif
+
 	QByteArray ba;
 	ba = d->loadData ("icondef.xml", dir);
 	if ( !ba.isEmpty() ) {
@@ -1431,8 +1810,15 @@ bool Iconset::load(const QString &dir)
 			qWarning("Iconset::load(): Failed to load iconset: icondef.xml is invalid XML");
 	}
 
+#ifdef ICONSET_ZIP
+	d->closeArchive();
+#endif
+
 	//QPixmap::setDefaultOptimization( optimization );
 
+	if ( registered_ )
+		IconsetFactoryPrivate::instance()->iconsetChanged(this);
+
 	return ret;
 }
 
@@ -1459,6 +1845,16 @@ void Iconset::setIcon(const QString &name, const PsiIcon &icon)
 	
 	d->remove(name);
 	d->append( name, newIcon );
+	if ( registered_ )
+		IconsetFactoryPrivate::instance()->iconsetChanged(this);
+}
+
+/**
+ * Returns all Icons by the names they were added with.
+ */
+const QHash<QString, PsiIcon *> &Iconset::iconDict() const
+{
+	return d->dict;
 }
 
 /**
@@ -1469,6 +1865,8 @@ void Iconset::removeIcon(const QString &name)
 	detach();
 
 	d->remove(name);
+	if ( registered_ )
+		IconsetFactoryPrivate::instance()->iconsetChanged(this);
 }
 
 /**
@@ -1586,6 +1984,7 @@ Q3MimeSourceFactory *Iconset::createMimeSourceFactory() const
  */
 void Iconset::addToFactory() const
 {
+	registered_ = true;
 	IconsetFactoryPrivate::instance()->registerIconset(this);
 }
 
@@ -1595,6 +1994,7 @@ void Iconset::addToFactory() const
 void Iconset::removeFromFactory() const
 {
 	IconsetFactoryPrivate::instance()->unregisterIconset(this);
+	registered_ = false;
 }
 
 /**
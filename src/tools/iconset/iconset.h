@@ -227,6 +227,12 @@ public:
 private:
 	class Private;
 	Private *d;
+	// set by addToFactory(), so that iconsets that are loaded in other
+	// threads never touch the factory
+	mutable bool registered_;
+
+	const QHash<QString, PsiIcon *> &iconDict() const;
+	friend class IconsetFactoryPrivate;
 };
 
 class IconsetFactory
@@ -2,6 +2,7 @@
 
 #include "iconset.h"
 #include "anim.h"
+#include "zip.h"
 
 class TestIconset: public QObject
 {
@@ -131,6 +132,31 @@ private slots:
 		QVERIFY(IconsetFactory::iconPtr("psi/message"));
 	}
 
+	void testFactoryPrecedence()
+	{
+		const PsiIcon *chat = IconsetFactory::iconPtr("psi/chat");
+
+		// later registered iconsets don't override existing names...
+		Iconset *small = new Iconset();
+		QVERIFY(small->load("iconsets/roster/small.jisp"));
+		small->addToFactory();
+		QCOMPARE(IconsetFactory::iconPtr("psi/chat"), chat);
+
+		// ...but take over when the earlier one is unregistered
+		iconset->removeFromFactory();
+		QCOMPARE(IconsetFactory::iconPtr("psi/chat"), small->icon("psi/chat"));
+		QCOMPARE(IconsetFactory::iconPtr("psi/headline"), (const PsiIcon *)0);
+
+		// changes to registered iconsets are picked up
+		small->setIcon("test/icon", *chat);
+		QVERIFY(IconsetFactory::iconPtr("test/icon") != 0);
+
+		delete small;
+		iconset->addToFactory();
+		QCOMPARE(IconsetFactory::iconPtr("psi/chat"), chat);
+		QCOMPARE(IconsetFactory::iconPtr("test/icon"), (const PsiIcon *)0);
+	}
+
 	void testCombineIconsets()
 	{
 		Iconset *is = new Iconset();
@@ -167,6 +193,88 @@ private slots:
 		delete is;
 	}
 		
+	void testLoadBundledIconsets()
+	{
+		// startup benchmark: every .jisp archive shipped in iconsets/ is
+		// read once through a single indexed handle, and once the old way
+		// by reopening the archive for every member
+		QStringList files;
+		foreach(QString sub, QStringList() << "emoticons" << "roster" << "system") {
+			QDir dir(QString(ICONSETS_DIR) + "/" + sub);
+			foreach(QString name, dir.entryList(QStringList() << "*.jisp", QDir::Files))
+				files << dir.filePath(name);
+		}
+		QVERIFY(!files.isEmpty());
+
+		const int rounds = 5;
+		int icons = 0;
+		foreach(QString file, files) {
+			Iconset is;
+			QVERIFY(is.load(file));
+			icons += is.count();
+		}
+
+		QList<QByteArray> indexedData, reopenedData;
+		QTime t;
+		t.start();
+		for (int i = 0; i < rounds; i++) {
+			indexedData.clear();
+			foreach(QString file, files) {
+				UnZip z(file);
+				QVERIFY(z.open());
+				foreach(QString member, z.list()) {
+					QByteArray ba;
+					z.readFile(member, &ba);
+					indexedData += ba;
+				}
+			}
+		}
+		int indexed = t.elapsed();
+
+		t.start();
+		for (int i = 0; i < rounds; i++) {
+			reopenedData.clear();
+			foreach(QString file, files) {
+				UnZip list(file);
+				QVERIFY(list.open());
+				foreach(QString member, list.list()) {
+					UnZip z(file);
+					QVERIFY(z.open());
+					QByteArray ba;
+					z.readFile(member, &ba);
+					reopenedData += ba;
+				}
+			}
+		}
+		int reopened = t.elapsed();
+
+		qDebug("%d iconsets (%d icons) x %d: indexed %d ms, reopened per member %d ms", files.count(), icons, rounds, indexed, reopened);
+		QVERIFY(indexedData == reopenedData);
+		QVERIFY(indexed <= reopened);
+	}
+
+	void testLazyDecoding()
+	{
+		// icons are decoded on first access, and stripping frames
+		// before that must give the same result as stripping after
+		Iconset *is = new Iconset();
+		QVERIFY(is->load("iconsets/roster/default.jisp"));
+
+		PsiIcon *stripped = (PsiIcon *)is->icon("psi/chat");
+		QVERIFY(stripped != 0);
+		stripped->stripFirstAnimFrame();
+		QCOMPARE(stripped->anim()->numFrames(), 14);
+
+		QListIterator<PsiIcon*> it = is->iterator();
+		while (it.hasNext()) {
+			PsiIcon *icon = it.next();
+			QVERIFY(!icon->pixmap().isNull());
+			QVERIFY(!icon->impix().isNull());
+		}
+
+		delete is;
+	}
+
 	void testMultipleIconTextStrings()
 	{
 		// all puz iconset icons contain multiple
@@ -7,6 +7,7 @@ include($$TESTBASEDIR/unittest.pri)
 QT += gui xml qt3support
 RESOURCES +=  ../../../../iconsets.qrc
 SOURCES += testiconset.cpp
+DEFINES += ICONSETS_DIR=\\\"$$PWD/../../../../iconsets\\\"
 
 # iconset library
 DEFINES += NO_ICONSET_SOUND
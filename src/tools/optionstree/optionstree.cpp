@@ -40,7 +40,7 @@ OptionsTree::OptionsTree(QObject *parent)
  */
 OptionsTree::~OptionsTree()
 {
-	
+	qDeleteAll(handles_);
 }
 
 /**
@@ -58,6 +58,47 @@ QVariant OptionsTree::getOption(const QString& name) const
 	return value;
 }
 
+/**
+ * Returns a handle to the specified option, for options read on hot paths
+ * \param name 'Path' to the option
+ */
+OptionHandle OptionsTree::handle(const QString& name) const
+{
+	return OptionHandle(this, name);
+}
+
+/**
+ * Returns the cached value cell for \a name, creating it on first use
+ */
+const QVariant *OptionsTree::resolve(const QString &name) const
+{
+	QVariant *cell = handles_.value(name);
+	if (!cell) {
+		cell = new QVariant(getOption(name));
+		handles_.insert(name, cell);
+	}
+	return cell;
+}
+
+/**
+ * Re-reads the cached value of \a name and all options below it, or of
+ * every handle if \a name is empty
+ */
+void OptionsTree::refreshHandles(const QString &name)
+{
+	if (handles_.isEmpty())
+		return;
+
+	QString prefix = name + '.';
+	QHash<QString, QVariant*>::Iterator it = handles_.begin();
+	for (; it != handles_.end(); ++it) {
+		if (name.isEmpty() || it.key() == name || it.key().startsWith(prefix)) {
+			const QVariant &value = tree_.getValue(it.key());
+			*it.value() = (value == VariantTree::missingValue) ? QVariant() : value;
+		}
+	}
+}
+
 /**
  * \brief Sets the value of the named option.
  * If the option or any parents in the 
@@ -78,6 +119,8 @@ void OptionsTree::setOption(const QString& name, const QVariant& value)
 		emit optionAboutToBeInserted(name);
 	}
 	tree_.setValue(name, value);
+	if (QVariant *cell = handles_.value(name))
+		*cell = value;
 	if (!prev.isValid()) {
 		emit optionInserted(name);
 	}
@@ -116,6 +159,7 @@ bool OptionsTree::removeOption(const QString &name, bool internal_nodes)
 {
 	emit optionAboutToBeRemoved(name);
 	bool ok = tree_.remove(name, internal_nodes);
+	refreshHandles(name);
 	emit optionRemoved(name);
 	return ok;
 }
@@ -280,5 +324,28 @@ bool OptionsTree::loadOptions(const QDomElement& base, const QString& configName
 
 	// Convert
 	tree_.fromXml(base);
+	refreshHandles();
 	return true;
 }
+
+
+//----------------------------------------------------------------------------
+// OptionHandle
+//----------------------------------------------------------------------------
+
+/**
+ * Creates a handle that refers to no option; its value is invalid
+ */
+OptionHandle::OptionHandle()
+{
+	static const QVariant invalid;
+	value_ = &invalid;
+}
+
+/**
+ * Resolves \a name in \a tree
+ */
+OptionHandle::OptionHandle(const OptionsTree *tree, const QString &name)
+	: value_(tree->resolve(name))
+{
+}
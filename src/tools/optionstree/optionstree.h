@@ -21,8 +21,35 @@
 #ifndef OPTIONSTREE_H
 #define OPTIONSTREE_H
 
+#include <QHash>
+
 #include "varianttree.h"
 
+class OptionsTree;
+
+/**
+ * \class OptionHandle
+ * \brief Resolved reference to a single option
+ * The option path is looked up once; reading the value afterwards is a
+ * pointer dereference.  The referenced value is kept up to date by the
+ * owning OptionsTree and stays valid for the lifetime of the tree.
+ */
+class OptionHandle
+{
+public:
+	OptionHandle();
+	OptionHandle(const OptionsTree *tree, const QString &name);
+
+	const QVariant &value() const { return *value_; }
+	bool toBool() const { return value_->toBool(); }
+	int toInt() const { return value_->toInt(); }
+	QString toString() const { return value_->toString(); }
+	QStringList toStringList() const { return value_->toStringList(); }
+
+private:
+	const QVariant *value_;
+};
+
 /**
  * \class OptionsTree
  * \brief Dynamic hierachical options structure
@@ -37,6 +64,7 @@ public:
 	~OptionsTree();
 	
 	QVariant getOption(const QString& name) const;
+	OptionHandle handle(const QString& name) const;
 	void setOption(const QString& name, const QVariant& value);
 	bool isInternalNode(const QString &node) const;
 	void setComment(const QString& name, const QString& comment);
@@ -69,7 +97,12 @@ signals:
 	void optionRemoved(const QString& option);
 	
 private:
+	friend class OptionHandle;
+	const QVariant *resolve(const QString &name) const;
+	void refreshHandles(const QString &name = QString());
+
 	VariantTree tree_;
+	mutable QHash<QString, QVariant*> handles_;
 };
 
 #endif
@@ -799,6 +799,48 @@ extern int ZEXPORT unzLocateFile (file, szFileName, iCaseSensitivity)
 }
 
 
+/*
+  Store the position of the current file, to come back to it later with
+  unzGoToFilePos (backported from minizip 1.01)
+*/
+extern int ZEXPORT unzGetFilePos (file, file_pos)
+	unzFile file;
+	unz_file_pos *file_pos;
+{
+	unz_s* s;
+
+	if (file==NULL || file_pos==NULL)
+		return UNZ_PARAMERROR;
+	s=(unz_s*)file;
+	if (!s->current_file_ok)
+		return UNZ_END_OF_LIST_OF_FILE;
+
+	file_pos->pos_in_zip_directory = s->pos_in_central_dir;
+	file_pos->num_of_file = s->num_file;
+	return UNZ_OK;
+}
+
+extern int ZEXPORT unzGoToFilePos (file, file_pos)
+	unzFile file;
+	unz_file_pos *file_pos;
+{
+	unz_s* s;
+	int err;
+
+	if (file==NULL || file_pos==NULL)
+		return UNZ_PARAMERROR;
+	s=(unz_s*)file;
+
+	s->pos_in_central_dir = file_pos->pos_in_zip_directory;
+	s->num_file = file_pos->num_of_file;
+	err = unzlocal_GetCurrentFileInfoInternal(file,&s->cur_file_info,
+											   &s->cur_file_info_internal,
+											   NULL,0,NULL,0,NULL,0);
+	s->current_file_ok = (err == UNZ_OK);
+	return err;
+}
+
+
 /*
   Read the local header of the current zipfile
   Check the coherency of the local header and info in the end of central
@@ -189,6 +189,29 @@ extern int ZEXPORT unzLocateFile OF((unzFile file,
 */
 
 
+/* Remember and jump back to a file in the zipfile without rescanning the
+   central directory (backported from minizip 1.01) */
+typedef struct unz_file_pos_s
+{
+	uLong pos_in_zip_directory;   /* offset in zip file directory */
+	uLong num_of_file;            /* # of file */
+} unz_file_pos;
+
+extern int ZEXPORT unzGetFilePos OF((unzFile file,
+				     unz_file_pos *file_pos));
+/*
+  Store the position of the current file in file_pos.
+  return UNZ_OK if there is no problem
+*/
+
+extern int ZEXPORT unzGoToFilePos OF((unzFile file,
+				      unz_file_pos *file_pos));
+/*
+  Set the current file of the zipfile to the one stored in file_pos.
+  return UNZ_OK if there is no problem
+*/
+
+
 extern int ZEXPORT unzGetCurrentFileInfo OF((unzFile file,
 					     unz_file_info *pfile_info,
 					     char *szFileName,
@@ -21,6 +21,7 @@
 #include <QString>
 #include <QStringList>
 #include <QFile>
+#include <QHash>
 
 #include "minizip/unzip.h"
 #include "zip.h"
@@ -33,6 +34,7 @@ public:
 	QString name;
 	unzFile uf;
 	QStringList listing;
+	QHash<QString, unz_file_pos> index; // name -> central directory entry
 };
 
 UnZip::UnZip(const QString &name)
@@ -77,6 +79,7 @@ void UnZip::close()
 	}
 
 	d->listing.clear();
+	d->index.clear();
 }
 
 const QStringList & UnZip::list() const
@@ -92,6 +95,7 @@ bool UnZip::getList()
 		return false;
 
 	QStringList l;
+	QHash<QString, unz_file_pos> index;
 	for(int n = 0; n < (int)gi.number_entry; ++n) {
 		char filename_inzip[256];
 		unz_file_info file_info;
@@ -101,6 +105,10 @@ bool UnZip::getList()
 
 		l += filename_inzip;
 
+		unz_file_pos pos;
+		if(unzGetFilePos(d->uf, &pos) == UNZ_OK)
+			index.insert(l.last(), pos);
+
 		if((n+1) < (int)gi.number_entry) {
 			err = unzGoToNextFile(d->uf);
 			if(err != UNZ_OK)
@@ -109,13 +117,22 @@ bool UnZip::getList()
 	}
 
 	d->listing = l;
+	d->index = index;
 
 	return true;
 }
 
 bool UnZip::readFile(const QString &fname, QByteArray *buf, int max)
 {
-	int err = unzLocateFile(d->uf, QFile::encodeName(fname).data(), 0);
+	// jump straight to the entry recorded by getList(); unzLocateFile()
+	// rescans the whole central directory and is only needed for
+	// case-insensitive matches
+	int err;
+	QHash<QString, unz_file_pos>::Iterator it = d->index.find(fname);
+	if(it != d->index.end())
+		err = unzGoToFilePos(d->uf, &it.value());
+	else
+		err = unzLocateFile(d->uf, QFile::encodeName(fname).data(), 0);
 	if(err != UNZ_OK)
 		return false;
 
@@ -0,0 +1,118 @@
+#include <QtTest/QtTest>
+#include <QCoreApplication>
+#include <QDir>
+#include <q3ptrlist.h>
+
+#include "eventdb.h"
+#include "psievent.h"
+#include "profiles.h"
+#include "applicationinfo.h"
+
+using namespace XMPP;
+
+class TestEventDB: public QObject
+{
+	Q_OBJECT
+private:
+	QString home;
+	EDBFlatFile *edb;
+	Jid jid;
+
+	void wait(EDBHandle *h)
+	{
+		while (h->busy())
+			QCoreApplication::processEvents(QEventLoop::WaitForMoreEvents);
+	}
+
+	QList<int> findAll(const QString &str)
+	{
+		QList<int> ids;
+		EDBHandle h(edb);
+		h.findAll(str, jid);
+		wait(&h);
+		if (h.result()) {
+			Q3PtrListIterator<EDBItem> it(*h.result());
+			for (EDBItem *i; (i = it.current()); ++it)
+				ids += i->id().toInt();
+		}
+		return ids;
+	}
+
+	void removeTree(const QString &path)
+	{
+		QDir dir(path);
+		foreach(QString name, dir.entryList(QDir::Dirs | QDir::NoDotAndDotDot))
+			removeTree(dir.filePath(name));
+		foreach(QString name, dir.entryList(QDir::Files))
+			dir.remove(name);
+		dir.rmdir(path);
+	}
+
+private slots:
+	void initTestCase()
+	{
+		home = QDir::tempPath() + "/testeventdb";
+		removeTree(home);
+		QVERIFY(QDir().mkpath(home + "/profiles/test"));
+		qputenv("PSIDATADIR", QFile::encodeName(home));
+		activeProfile = "test";
+
+		jid = Jid("someone@example.com");
+		edb = new EDBFlatFile;
+
+		QStringList bodies;
+		bodies << "Hello world"
+		       << "shellfish for dinner"
+		       << "hellos world"
+		       << QString::fromUtf8("\xe6\x9c\x9d\xe6\x97\xa5\xe6\x96\xb0\xe8\x81\x9e\xe3\x82\x92\xe8\xaa\xad\xe3\x82\x80")
+		       << "nothing to see here";
+
+		EDBHandle h(edb);
+		foreach(QString body, bodies) {
+			Message m;
+			m.setFrom(jid);
+			m.setBody(body);
+			m.setTimeStamp(QDateTime::currentDateTime());
+			MessageEvent e(m, 0);
+			h.append(jid, &e);
+		}
+		edb->flush();
+		wait(&h);
+	}
+
+	void cleanupTestCase()
+	{
+		delete edb;
+		removeTree(home);
+	}
+
+	void testWholeWords()
+	{
+		QCOMPARE(findAll("world"), QList<int>() << 0 << 2);
+		QCOMPARE(findAll("hello world"), QList<int>() << 0);
+	}
+
+	void testMidWordSubstring()
+	{
+		QCOMPARE(findAll("ello"), QList<int>() << 0 << 2);
+		QCOMPARE(findAll("ELL"), QList<int>() << 0 << 1 << 2);
+		QCOMPARE(findAll("llos wor"), QList<int>() << 2);
+		QCOMPARE(findAll("o wor"), QList<int>() << 0);
+		QCOMPARE(findAll("fish for din"), QList<int>() << 1);
+	}
+
+	void testRunWithoutSpaces()
+	{
+		// CJK text is stored as a single word, found from any position
+		QCOMPARE(findAll(QString::fromUtf8("\xe6\x96\xb0\xe8\x81\x9e")), QList<int>() << 3);
+	}
+
+	void testNotFound()
+	{
+		QVERIFY(findAll("xyz").isEmpty());
+		QVERIFY(findAll("world hello").isEmpty());
+	}
+};
+
+QTEST_MAIN(TestEventDB)
+#include "testeventdb.moc"
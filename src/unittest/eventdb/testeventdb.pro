@@ -0,0 +1,4 @@
+TARGET = testeventdb
+SOURCES += testeventdb.cpp
+
+include(../half_of_psi.pri)
@@ -0,0 +1,95 @@
+#include <QtTest/QtTest>
+#include <QStringList>
+#include <QTime>
+
+#include "textutil.h"
+#include "iconset.h"
+#include "psiiconset.h"
+
+// formats a message the way the chat dialogs did before formatMessage()
+static QString chainFormat(const QString &plain, bool emoticons, bool legacy)
+{
+	QString txt = TextUtil::plain2rich(plain);
+	txt = TextUtil::linkify(txt);
+	if (emoticons)
+		txt = TextUtil::emoticonify(txt);
+	if (legacy)
+		txt = TextUtil::legacyFormat(txt);
+	return txt;
+}
+
+class TestTextUtil: public QObject
+{
+	Q_OBJECT
+private:
+	QStringList corpus;
+
+private slots:
+	void initTestCase()
+	{
+		Iconset *is = new Iconset;
+		QVERIFY(is->load(TEST_ICONSETS_DIR "/emoticons/puz.jisp"));
+		PsiIconset::instance()->emoticons.append(is);
+
+		corpus << "hi"
+		       << "how are you doing today?"
+		       << "see http://psi-im.org/download for the latest build"
+		       << "mail me at someone@example.com or visit www.example.com."
+		       << "this is *really* important, _please_ read /carefully/"
+		       << "a <b>fake</b> tag & an \"entity\" that must be escaped"
+		       << "first line\nsecond line\n\nfourth line"
+		       << "(ftp.example.org) and https://example.com/a?b=1&c=2!"
+		       << "hi :be: there (U) :bheart:"
+		       << ">:D and >8-D at the start, :be-be-be: is longer than :be:"
+		       << ":zorro:, :Z: and :z: next to punctuation!"
+		       << "see http://psi-im.org :be: and mail someone@example.com (u)"
+		       << "*bold* :kazak: _under_ :bud: /slanted/";
+
+		// a long pasted log
+		QString paste;
+		for (int i = 0; i < 50; ++i)
+			paste += QString("[12:%1] <nick%2> checking https://bugs.example.com/%3 *again*\n").arg(i % 60).arg(i % 7).arg(i * 13);
+		corpus << paste;
+	}
+
+	void testMatchesChain()
+	{
+		foreach(QString msg, corpus) {
+			QCOMPARE(TextUtil::formatMessage(msg, false, false), chainFormat(msg, false, false));
+			QCOMPARE(TextUtil::formatMessage(msg, false, true), chainFormat(msg, false, true));
+			QCOMPARE(TextUtil::formatMessage(msg, true, false), chainFormat(msg, true, false));
+			QCOMPARE(TextUtil::formatMessage(msg, true, true), chainFormat(msg, true, true));
+		}
+	}
+
+	// formats the corpus both ways, and checks the single pass isn't slower
+	void testFormatIsFaster()
+	{
+		const int rounds = 200;
+		QStringList chainOut, singleOut;
+
+		QTime t;
+		t.start();
+		for (int n = 0; n < rounds; ++n) {
+			chainOut.clear();
+			foreach(QString msg, corpus)
+				chainOut += chainFormat(msg, true, true);
+		}
+		int chain = t.elapsed();
+
+		t.start();
+		for (int n = 0; n < rounds; ++n) {
+			singleOut.clear();
+			foreach(QString msg, corpus)
+				singleOut += TextUtil::formatMessage(msg, true, true);
+		}
+		int single = t.elapsed();
+
+		qDebug("plain2rich+linkify+emoticonify+legacyFormat: %d ms, formatMessage: %d ms", chain, single);
+		QCOMPARE(singleOut, chainOut);
+		QVERIFY(single <= chain);
+	}
+};
+
+QTEST_MAIN(TestTextUtil)
+#include "testtextutil.moc"
@@ -0,0 +1,5 @@
+TARGET = testtextutil
+SOURCES += testtextutil.cpp
+DEFINES += TEST_ICONSETS_DIR=\\\"$$PWD/../../tools/iconset/unittest/iconsets\\\"
+
+include(../half_of_psi.pri)
\ No newline at end of file
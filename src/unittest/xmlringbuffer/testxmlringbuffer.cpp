@@ -0,0 +1,89 @@
+#include <QtTest/QtTest>
+#include <QStringList>
+
+#include "xmlringbuffer.h"
+
+static QStringList contents(const XmlRingBuffer& buffer)
+{
+	QStringList ret;
+	XmlRingBuffer::ConstIterator it(buffer);
+	while (it.next())
+		ret << it.xml();
+	return ret;
+}
+
+class TestXmlRingBuffer: public QObject
+{
+	Q_OBJECT
+private slots:
+	void testRoundTrip()
+	{
+		XmlRingBuffer buffer(1024, 256);
+		QString xml = QString::fromUtf8("<message><body>h\xc3\xa9llo \xe2\x82\xac \xf0\x9f\x98\x80</body></message>");
+		buffer.append(1, xml);
+
+		XmlRingBuffer::ConstIterator it(buffer);
+		QVERIFY(it.next());
+		QCOMPARE(it.type(), 1);
+		QCOMPARE(it.xml(), xml);
+		QCOMPARE(it.data(), xml.toUtf8());
+		QVERIFY(qAbs(it.time().secsTo(QDateTime::currentDateTime())) < 5);
+		QVERIFY(!it.next());
+	}
+
+	void testByteBound()
+	{
+		XmlRingBuffer buffer(1000, 100);
+		for (int i = 0; i < 500; ++i)
+			buffer.append(0, QString("<iq id='%1'/>").arg(i));
+
+		QVERIFY(buffer.size() <= 1000);
+		QStringList list = contents(buffer);
+		QVERIFY(!list.isEmpty());
+		QCOMPARE(list.last(), QString("<iq id='499'/>"));
+		for (int i = 0; i < list.count(); ++i)
+			QCOMPARE(list[i], QString("<iq id='%1'/>").arg(500 - list.count() + i));
+	}
+
+	void testOversized()
+	{
+		XmlRingBuffer buffer(1000, 100);
+		buffer.append(0, QString(300, 'x'));
+		QCOMPARE(contents(buffer), QStringList() << QString(300, 'x'));
+
+		buffer.append(0, QString(2000, 'y'));
+		QCOMPARE(contents(buffer), QStringList() << QString(300, 'x'));
+	}
+
+	void testCompressedHistory()
+	{
+		XmlRingBuffer plain(1000, 100);
+		XmlRingBuffer packed(1000, 100, 4000);
+		for (int i = 0; i < 500; ++i) {
+			QString xml = QString("<presence from='user%1@example.com/psi'/>").arg(i);
+			plain.append(0, xml);
+			packed.append(0, xml);
+		}
+
+		QStringList recent = contents(plain);
+		QStringList all = contents(packed);
+		QVERIFY(packed.compressedSize() > 0);
+		QVERIFY(packed.compressedSize() <= 4000);
+		QVERIFY(all.count() > recent.count());
+		QCOMPARE(all.mid(all.count() - recent.count()), recent);
+	}
+
+	void testClear()
+	{
+		XmlRingBuffer buffer(1000, 100, 1000);
+		for (int i = 0; i < 100; ++i)
+			buffer.append(0, "<r/>");
+		buffer.clear();
+		QVERIFY(contents(buffer).isEmpty());
+		QCOMPARE(buffer.size(), 0);
+		QCOMPARE(buffer.compressedSize(), 0);
+	}
+};
+
+QTEST_MAIN(TestXmlRingBuffer)
+#include "testxmlringbuffer.moc"
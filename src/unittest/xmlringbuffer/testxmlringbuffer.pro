@@ -0,0 +1,4 @@
+TARGET = testxmlringbuffer
+SOURCES += testxmlringbuffer.cpp
+
+include(../half_of_psi.pri)
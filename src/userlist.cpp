@@ -689,11 +689,44 @@ UserList::~UserList()
 
 UserListItem *UserList::find(const XMPP::Jid &j)
 {
-	UserListIt it(*this);
-	for(UserListItem *i; (i = it.current()); ++it) {
+	foreach(UserListItem *i, byBare_.value(j.bare())) {
 		if(i->jid().compare(j))
 			return i;
 	}
 	return 0;
 }
 
+/**
+ * Returns all items with the same bare jid as \a j, in the order they
+ * were added to the list.
+ */
+QList<UserListItem*> UserList::findBare(const XMPP::Jid &j) const
+{
+	return byBare_.value(j.bare());
+}
+
+// Every insertion into and removal from the list goes through these two,
+// so the index is kept in sync no matter which Q3PtrList function is used.
+// The jid of an item must not change while it is in the list.
+Q3PtrCollection::Item UserList::newItem(Item d)
+{
+	UserListItem *u = (UserListItem *)d;
+	byBare_[u->jid().bare()].append(u);
+	return d;
+}
+
+void UserList::deleteItem(Item d)
+{
+	UserListItem *u = (UserListItem *)d;
+	QString key = u->jid().bare();
+	QHash<QString, QList<UserListItem*> >::Iterator it = byBare_.find(key);
+	if(it != byBare_.end()) {
+		it.value().removeAll(u);
+		if(it.value().isEmpty())
+			byBare_.erase(it);
+	}
+
+	if(autoDelete())
+		delete u;
+}
+
@@ -24,6 +24,7 @@
 #include <qstring.h>
 #include <qdatetime.h>
 #include <QList>
+#include <QHash>
 #include <QPixmap>
 #include <Q3PtrList>
 #include "xmpp_resource.h"
@@ -170,6 +171,15 @@ public:
 	~UserList();
 
 	UserListItem *find(const XMPP::Jid &);
+	QList<UserListItem*> findBare(const XMPP::Jid &) const;
+
+protected:
+	Item newItem(Item);
+	void deleteItem(Item);
+
+private:
+	// items by bare jid, in the order they were added
+	QHash<QString, QList<UserListItem*> > byBare_;
 };
 
 #endif
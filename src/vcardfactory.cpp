@@ -20,13 +20,11 @@
 
 #include <QObject>
 #include <QApplication>
-#include <QMap>
+#include <QHash>
 #include <QDomDocument>
 #include <QFile>
-#include <QTextStream>
-#include <QDir>
+#include <QDataStream>
 
-#include "profiles.h"
 #include "applicationinfo.h"
 #include "vcardfactory.h"
 #include "jidutil.h"
@@ -34,11 +32,258 @@
 #include "xmpp_vcard.h"
 #include "xmpp_tasks.h"
 
+// number of vCards kept parsed in memory by default
+#define VCARD_CACHE_SIZE 50
+
+//----------------------------------------------------------------------------
+// VCardStore
+//----------------------------------------------------------------------------
+
+#define VCARDSTORE_MAGIC   0x50535643 // "PSVC"
+#define VCARDSTORE_VERSION 1
+
+/**
+ * \brief Single file storage for all cached vCards.
+ *
+ * Records are appended to the file, each consisting of the bare jid, the
+ * vCard XML without the photo, and the raw photo data. The file is scanned
+ * once on open to build the jid -> offset index, so reading a vCard later
+ * is a seek, and the photo can be read without parsing the vCard at all.
+ * Overwritten records are dropped when the file is compacted.
+ */
+class VCardStore
+{
+public:
+	VCardStore(const QString &fileName);
+
+	bool contains(const QString &jid) const;
+	bool read(const QString &jid, QByteArray *xml, QByteArray *photo);
+	QByteArray photo(const QString &jid);
+	void write(const QString &jid, const QByteArray &xml, const QByteArray &photo);
+
+private:
+	struct Entry {
+		qint64 record, xml, photo;
+		quint32 xmlSize, photoSize;
+
+		qint64 recordSize() const { return photo + photoSize - record; }
+	};
+
+	QFile file_;
+	QHash<QString, Entry> index_;
+	qint64 live_, garbage_;
+
+	void open();
+	bool readBlock(qint64 pos, quint32 size, QByteArray *data);
+	void compact();
+};
+
+VCardStore::VCardStore(const QString &fileName)
+	: file_(fileName), live_(0), garbage_(0)
+{
+	open();
+}
+
+void VCardStore::open()
+{
+	// a compact() that was interrupted left the previous store behind
+	QString oldName = file_.fileName() + ".old";
+	if (!file_.exists() && QFile::exists(oldName))
+		QFile::rename(oldName, file_.fileName());
+
+	if (!file_.open(QIODevice::ReadWrite))
+		return;
+
+	QDataStream s(&file_);
+	s.setVersion(QDataStream::Qt_4_2);
+
+	if (file_.size() == 0) {
+		s << (quint32)VCARDSTORE_MAGIC << (qint32)VCARDSTORE_VERSION;
+		file_.flush();
+		return;
+	}
+
+	quint32 magic;
+	qint32 version;
+	s >> magic >> version;
+	if (magic != VCARDSTORE_MAGIC || version != VCARDSTORE_VERSION) {
+		qWarning("VCardStore: %s has unknown format, discarding", qPrintable(file_.fileName()));
+		file_.resize(0);
+		s.resetStatus();
+		file_.seek(0);
+		s << (quint32)VCARDSTORE_MAGIC << (qint32)VCARDSTORE_VERSION;
+		file_.flush();
+		return;
+	}
+
+	// skip over the data blocks, we only need to know where they are
+	while (!file_.atEnd()) {
+		QString jid;
+		Entry e;
+		e.record = file_.pos();
+		s >> jid >> e.xmlSize;
+		if (e.xmlSize == 0xffffffff)
+			e.xmlSize = 0;
+		e.xml = file_.pos();
+		file_.seek(e.xml + e.xmlSize);
+		s >> e.photoSize;
+		if (e.photoSize == 0xffffffff)
+			e.photoSize = 0;
+		e.photo = file_.pos();
+
+		// a record that was not completely written
+		if (s.status() != QDataStream::Ok || e.photo + e.photoSize > file_.size()) {
+			file_.resize(e.record);
+			break;
+		}
+		file_.seek(e.photo + e.photoSize);
+
+		if (index_.contains(jid)) {
+			garbage_ += index_[jid].recordSize();
+			live_ -= index_[jid].recordSize();
+		}
+		live_ += e.recordSize();
+		index_.insert(jid, e);
+	}
+}
+
+bool VCardStore::contains(const QString &jid) const
+{
+	return index_.contains(jid);
+}
+
+bool VCardStore::readBlock(qint64 pos, quint32 size, QByteArray *data)
+{
+	if (!file_.seek(pos))
+		return false;
+	*data = file_.read(size);
+	return (quint32)data->size() == size;
+}
+
+bool VCardStore::read(const QString &jid, QByteArray *xml, QByteArray *photo)
+{
+	QHash<QString, Entry>::ConstIterator it = index_.find(jid);
+	if (it == index_.end())
+		return false;
+
+	return readBlock(it->xml, it->xmlSize, xml) && readBlock(it->photo, it->photoSize, photo);
+}
+
+/**
+ * Returns the photo stored with the vCard of \a jid, without reading
+ * the rest of the vCard.
+ */
+QByteArray VCardStore::photo(const QString &jid)
+{
+	QByteArray data;
+	QHash<QString, Entry>::ConstIterator it = index_.find(jid);
+	if (it != index_.end())
+		readBlock(it->photo, it->photoSize, &data);
+	return data;
+}
+
+void VCardStore::write(const QString &jid, const QByteArray &xml, const QByteArray &photo)
+{
+	if (!file_.isOpen() || !file_.seek(file_.size()))
+		return;
+
+	QDataStream s(&file_);
+	s.setVersion(QDataStream::Qt_4_2);
+
+	Entry e;
+	e.record = file_.pos();
+	s << jid;
+	e.xml = file_.pos() + sizeof(quint32);
+	e.xmlSize = xml.size();
+	s << xml;
+	e.photo = file_.pos() + sizeof(quint32);
+	e.photoSize = photo.size();
+	s << photo;
+	file_.flush();
+
+	if (index_.contains(jid)) {
+		garbage_ += index_[jid].recordSize();
+		live_ -= index_[jid].recordSize();
+	}
+	live_ += e.recordSize();
+	index_.insert(jid, e);
+
+	if (garbage_ > 65536 && garbage_ > live_)
+		compact();
+}
+
+/**
+ * Rewrites the file with the current record of every jid only.
+ */
+void VCardStore::compact()
+{
+	QFile out(file_.fileName() + ".new");
+	if (!out.open(QIODevice::WriteOnly))
+		return;
+
+	QDataStream s(&out);
+	s.setVersion(QDataStream::Qt_4_2);
+	s << (quint32)VCARDSTORE_MAGIC << (qint32)VCARDSTORE_VERSION;
+
+	QHash<QString, Entry> index;
+	QHashIterator<QString, Entry> it(index_);
+	while (it.hasNext()) {
+		it.next();
+		QByteArray xml, photo;
+		if (!read(it.key(), &xml, &photo))
+			continue;
+
+		Entry e;
+		e.record = out.pos();
+		s << it.key();
+		e.xml = out.pos() + sizeof(quint32);
+		e.xmlSize = xml.size();
+		s << xml;
+		e.photo = out.pos() + sizeof(quint32);
+		e.photoSize = photo.size();
+		s << photo;
+		index.insert(it.key(), e);
+	}
+
+	if (s.status() != QDataStream::Ok) {
+		out.remove();
+		return;
+	}
+	out.close();
+
+	// swap the files, keeping the old one until the new one is in place
+	QString fileName = file_.fileName();
+	QString oldName = fileName + ".old";
+	file_.close();
+	QFile::remove(oldName);
+	if (!QFile::rename(fileName, oldName)) {
+		out.remove();
+		file_.open(QIODevice::ReadWrite);
+		return;
+	}
+	if (!QFile::rename(out.fileName(), fileName)) {
+		QFile::rename(oldName, fileName);
+		out.remove();
+		file_.open(QIODevice::ReadWrite);
+		return;
+	}
+	QFile::remove(oldName);
+
+	file_.setFileName(fileName);
+	file_.open(QIODevice::ReadWrite);
+	index_ = index;
+	garbage_ = 0;
+}
+
+//----------------------------------------------------------------------------
+// VCardFactory
+//----------------------------------------------------------------------------
+
 /**
  * \brief Factory for retrieving and changing VCards.
  */
 VCardFactory::VCardFactory()
-	: QObject(qApp), dictSize_(5)
+	: QObject(qApp), cache_(VCARD_CACHE_SIZE), store_(0)
 {
 }
 
@@ -47,8 +292,7 @@ VCardFactory::VCardFactory()
  */
 VCardFactory::~VCardFactory()
 {
-	foreach (VCard *vcard, vcardDict_)
-		delete vcard;
+	delete store_;
 }
 
 /**
@@ -62,26 +306,44 @@ VCardFactory* VCardFactory::instance()
 	return instance_;
 }
 
+/**
+ * Returns the number of vCards that are kept parsed in memory.
+ */
+int VCardFactory::cacheSize() const
+{
+	return cache_.maxCost();
+}
+
+/**
+ * Sets the number of vCards that are kept parsed in memory to \a size.
+ * Note that pointers returned by vcard() are only valid until the vCard
+ * is dropped from this cache.
+ */
+void VCardFactory::setCacheSize(int size)
+{
+	cache_.setMaxCost(qMax(size, 1));
+}
 
 /**
- * Adds a vcard to the cache (and removes other items if necessary)
+ * Returns the store of the active profile.  When the profile was switched
+ * since the last call, the vCards of the previous one are forgotten.
  */
-void VCardFactory::checkLimit(QString jid, VCard *vcard)
+VCardStore *VCardFactory::store()
 {
-	if (vcardList_.contains(jid)) {
-		vcardList_.remove(jid);
-		delete vcardDict_.take(jid);
+	QString dir = ApplicationInfo::vCardDir();
+	if (store_ && dir != storeDir_) {
+		delete store_;
+		store_ = 0;
+		cache_.clear();
+		missing_.clear();
 	}
-	else if (vcardList_.size() > dictSize_) {
-		QString j = vcardList_.takeLast();
-		delete vcardDict_.take(j);
+	if (!store_) {
+		store_ = new VCardStore(dir + "/vcards.dat");
+		storeDir_ = dir;
 	}
-
-	vcardDict_[jid] = vcard;
-	vcardList_.push_front(jid);
+	return store_;
 }
 
-
 void VCardFactory::taskFinished()
 {
 	JT_VCard *task = (JT_VCard *)sender();
@@ -94,55 +356,112 @@ void VCardFactory::taskFinished()
 
 void VCardFactory::saveVCard(const Jid& j, const VCard& _vcard)
 {
+	VCardStore *store = this->store();
+
 	VCard *vcard = new VCard;
 	*vcard = _vcard;
-	checkLimit(j.userHost(), vcard);
-
-	// save vCard to disk
-
-	// ensure that there's a vcard directory to save into
-	QDir p(pathToProfile(activeProfile));
-	QDir v(pathToProfile(activeProfile) + "/vcard");
-	if(!v.exists())
-		p.mkdir("vcard");
+	cache_.insert(j.userHost(), vcard);
+	missing_.remove(j.userHost());
 
-	QFile file ( ApplicationInfo::vCardDir() + "/" + JIDUtil::encode(j.userHost()).lower() + ".xml" );
-	file.open ( QIODevice::WriteOnly );
-	QTextStream out ( &file );
-	out.setEncoding ( QTextStream::UnicodeUTF8 );
+	// the photo is stored as is next to the vCard, so that it doesn't
+	// have to be base64-coded, and can be read on its own
+	VCard v = _vcard;
+	v.setPhoto(QByteArray());
 	QDomDocument doc;
-	doc.appendChild( vcard->toXml ( &doc ) );
-	out << doc.toString(4);
+	doc.appendChild( v.toXml ( &doc ) );
+	store->write(j.userHost(), doc.toByteArray(0), _vcard.photo());
 
 	Jid jid = j;
 	emit vcardChanged(jid);
 }
 
+/**
+ * Moves a vCard saved by older versions, which used one XML file per
+ * jid, into the store.
+ */
+VCard *VCardFactory::importLegacyVCard(const QString &jid)
+{
+	QFile file ( ApplicationInfo::vCardDir() + "/" + JIDUtil::encode(jid).lower() + ".xml" );
+	if (!file.open(QIODevice::ReadOnly))
+		return 0;
+
+	QDomDocument doc;
+	if ( !doc.setContent(&file, false) )
+		return 0;
+	file.close();
+
+	VCard *vcard = new VCard;
+	vcard->fromXml( doc.documentElement() );
+
+	VCard v = *vcard;
+	v.setPhoto(QByteArray());
+	QDomDocument stripped;
+	stripped.appendChild( v.toXml ( &stripped ) );
+	store()->write(jid, stripped.toByteArray(0), vcard->photo());
+	file.remove();
+
+	return vcard;
+}
+
 /**
  * \brief Call this, when you need a cached vCard.
  */
 const VCard* VCardFactory::vcard(const Jid &j)
 {
+	QString jid = j.userHost();
+	VCardStore *store = this->store();
+
 	// first, try to get vCard from runtime cache
-	if (vcardDict_.contains(j.userHost())) {
-		return vcardDict_[j.userHost()];
-	}
-	
-	// then try to load from cache on disk
-	QFile file ( ApplicationInfo::vCardDir() + "/" + JIDUtil::encode(j.userHost()).lower() + ".xml" );
-	file.open (QIODevice::ReadOnly);
-	QDomDocument doc;
-	VCard *vcard = new VCard;
-	if ( doc.setContent(&file, false) ) {
-		vcard->fromXml( doc.documentElement() );
-		checkLimit(j.userHost(), vcard);
+	VCard *vcard = cache_.object(jid);
+	if (vcard)
 		return vcard;
+
+	if (missing_.contains(jid))
+		return 0;
+
+	// then try to load from cache on disk
+	QByteArray xml, photo;
+	if (store->read(jid, &xml, &photo)) {
+		QDomDocument doc;
+		if ( doc.setContent(xml, false) ) {
+			vcard = new VCard;
+			vcard->fromXml( doc.documentElement() );
+			vcard->setPhoto( photo );
+		}
+	}
+	else {
+		vcard = importLegacyVCard(jid);
 	}
 
-	delete vcard;
-	return 0;
+	if (!vcard) {
+		missing_.insert(jid);
+		return 0;
+	}
+
+	cache_.insert(jid, vcard);
+	return vcard;
 }
 
+/**
+ * \brief Returns the photo of the cached vCard of \a j.
+ *
+ * Unlike vcard(), this doesn't parse the vCard when it's not in memory.
+ */
+QByteArray VCardFactory::photo(const Jid &j)
+{
+	QString jid = j.userHost();
+	VCardStore *store = this->store();
+
+	const VCard *vcard = cache_.object(jid);
+	if (vcard)
+		return vcard->photo();
+
+	if (store->contains(jid))
+		return store->photo(jid);
+
+	vcard = this->vcard(j);
+	return vcard ? vcard->photo() : QByteArray();
+}
 
 /**
  * \brief Call this when you need to update vCard in cache.
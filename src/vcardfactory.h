@@ -22,8 +22,9 @@
 #define VCARDFACTORY_H
 
 #include <QObject>
-#include <QMap>
-#include <QStringList>
+#include <QCache>
+#include <QSet>
+#include <QByteArray>
 
 namespace XMPP {
 	class VCard;
@@ -34,6 +35,7 @@ namespace XMPP {
 using namespace XMPP;
 
 class PsiAccount;
+class VCardStore;
 
 class VCardFactory : public QObject
 {
@@ -42,16 +44,17 @@ class VCardFactory : public QObject
 public:
 	static VCardFactory* instance();
 	const VCard *vcard(const Jid &);
+	QByteArray photo(const Jid &);
 	void setVCard(const Jid &, const VCard &);
 	void setVCard(const PsiAccount* account, const VCard &v, QObject* obj = 0, const char* slot = 0);
 	JT_VCard *getVCard(const Jid &, Task *rootTask, const QObject *, const char *slot, bool cacheVCard = true);
+
+	int cacheSize() const;
+	void setCacheSize(int);
 	
 signals:
 	void vcardChanged(const Jid&);
 	
-protected:
-	void checkLimit(QString jid, VCard *vcard);
-	
 private slots:
 	void updateVCardFinished();
 	void taskFinished();
@@ -61,10 +64,13 @@ private:
 	~VCardFactory();
 	
 	static VCardFactory* instance_;
-	const int dictSize_;
-	QStringList vcardList_;
-	QMap<QString,VCard*> vcardDict_;
+	QCache<QString,VCard> cache_;
+	QSet<QString> missing_;
+	VCardStore *store_;
+	QString storeDir_;
 
+	VCardStore *store();
+	VCard *importLegacyVCard(const QString &jid);
 	void saveVCard(const Jid &, const VCard &);
 };
 
@@ -30,6 +30,7 @@ void WbScene::queueTransformationRegeneration(WbItem* item) {
 }
 
 void WbScene::regenerateTransformations() {
+    session_->beginBatch();
 	foreach(QPointer<WbItem> item, pendingTranformations_) {
 		if(item) {
             // qDebug(QString("Regenerating %1 transform.").arg((unsigned int) &(*item)).toAscii());
@@ -38,6 +39,7 @@ void WbScene::regenerateTransformations() {
 	}
 	pendingTranformations_.clear();
     session_->flush();
+    session_->endBatch();
 }
 
 QPointF WbScene::selectionCenter() const {
@@ -78,6 +80,8 @@ static bool zValueLessThan(QGraphicsItem* item1, QGraphicsItem* item2) {
 
 void WbScene::group() {
     if(selectedItems().size() > 1) {
+        session_->beginBatch();
+
         // Create the group
         QDomElement temp = QDomDocument().createElement("g");
         temp.setAttribute("id", "e" + SxeSession::generateUUID());
@@ -96,10 +100,12 @@ void WbScene::group() {
         clearSelection();
         
         session_->flush();
+        session_->endBatch();
     }
 }
 
 void WbScene::ungroup() {
+    session_->beginBatch();
     foreach(QGraphicsItem* item, selectedItems()) {        
         // find the QDomElement matching the selected item
         WbItem* wbitem = dynamic_cast<WbItem*>(item);
@@ -136,12 +142,15 @@ void WbScene::ungroup() {
     clearSelection();
 
     session_->flush();
+    session_->endBatch();
 }
 
 void WbScene::bring(int n, bool toExtremum) {
     if(n == 0)
          return;
 
+    session_->beginBatch();
+
     // bring each selected item
     foreach(QGraphicsItem* selecteditem, selectedItems()) {
 
@@ -194,4 +203,5 @@ void WbScene::bring(int n, bool toExtremum) {
     }
 
     session_->flush();
+    session_->endBatch();
 }
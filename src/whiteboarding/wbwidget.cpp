@@ -33,6 +33,7 @@ WbWidget::WbWidget(SxeSession* session, QWidget *parent) : QGraphicsView(parent)
 	strokeColor_ = Qt::black;
 	fillColor_ = Qt::transparent;
 	strokeWidth_ = 1;
+    rerenderAll_ = false;
     session_ = session;
 
 //	setCacheMode(CacheBackground);
@@ -49,8 +50,8 @@ WbWidget::WbWidget(SxeSession* session, QWidget *parent) : QGraphicsView(parent)
 
     // render the initial document
     rerender();
-    // rerender on update
-    connect(session_, SIGNAL(documentUpdated(bool)), SLOT(handleDocumentUpdated(bool)));
+    // add, remove and rerender items once per batch of changes
+    connect(session_, SIGNAL(documentChanged(SxeChangeSet, bool)), SLOT(handleDocumentChanged(const SxeChangeSet &, bool)));
     
     // add the initial items
     const QDomNodeList children = session_->document().documentElement().childNodes();
@@ -62,17 +63,11 @@ WbWidget::WbWidget(SxeSession* session, QWidget *parent) : QGraphicsView(parent)
     }
     inspectNodes();
 
-    // add new items as nodes are added
-    // remove/add items if corresponding nodes are moved
-    connect(session_, SIGNAL(nodeAdded(QDomNode, bool)), SLOT(queueNodeInspection(QDomNode)));
-    connect(session_, SIGNAL(nodeMoved(QDomNode, bool)), SLOT(queueNodeInspection(QDomNode)));
     // remove items if corresponding nodes are deleted
+    // (while the nodes are still in the document)
     connect(session_, SIGNAL(nodeToBeRemoved(QDomNode, bool)), SLOT(removeWbItem(QDomNode)));
     connect(session_, SIGNAL(nodeToBeRemoved(QDomNode, bool)), SLOT(checkForRemovalOfId(QDomNode)));
-    // adjust the viewBox as necessary
-    connect(session_, SIGNAL(nodeAdded(QDomNode, bool)), SLOT(checkForViewBoxChange(QDomNode)));
-    connect(session_, SIGNAL(nodeMoved(QDomNode, bool)), SLOT(checkForViewBoxChange(QDomNode)));
-    connect(session_, SIGNAL(chdataChanged(QDomNode, bool)), SLOT(checkForViewBoxChange(QDomNode)));
+    connect(session_, SIGNAL(nodeToBeRemoved(QDomNode, bool)), SLOT(queueRerender(QDomNode)));
 
     // set the default mode to select
 	setMode(Select);
@@ -185,12 +180,14 @@ void WbWidget::setStrokeWidth(int width) {
 }
 
 void WbWidget::clear() {
+    session_->beginBatch();
 	foreach(QGraphicsItem* graphicsitem, scene_->items()) {
         WbItem* wbitem = dynamic_cast<WbItem*>(graphicsitem);
         if(wbitem)
             session_->removeNode(wbitem->node());
 	}
     session_->flush();
+    session_->endBatch();
 }
 
 QSize WbWidget::sizeHint() const {
@@ -282,11 +279,13 @@ void WbWidget::mouseMoveEvent(QMouseEvent * event) {
          // Erase all items that appear in a 2*strokeWidth_ square with center at the event position
          QPointF p = mapToScene(mapFromGlobal(event->globalPos()));
          QGraphicsRectItem* eraseRect = scene_->addRect(QRectF(p.x() - strokeWidth_, p.y() - strokeWidth_, 2 * strokeWidth_, 2 * strokeWidth_));
+         session_->beginBatch();
          foreach(QGraphicsItem * item, eraseRect->collidingItems()) {
             WbItem* wbitem = dynamic_cast<WbItem*>(item);
             if(wbitem)
                 session_->removeNode(wbitem->node());
          }
+         session_->endBatch();
          delete eraseRect;
          eraseRect = 0;
          
@@ -321,10 +320,36 @@ WbItem* WbWidget::wbItem(const QDomNode &node) {
     return 0;
 }
 
-void WbWidget::handleDocumentUpdated(bool remote) {
+void WbWidget::handleDocumentChanged(const SxeChangeSet &changes, bool remote) {
     Q_UNUSED(remote);
+
+    foreach(QDomNode node, changes.added) {
+        queueNodeInspection(node);
+        checkForViewBoxChange(node);
+        queueRerender(node);
+    }
+    foreach(QDomNode node, changes.moved) {
+        queueNodeInspection(node);
+        checkForViewBoxChange(node);
+        // the previous parent of the node is not known anymore
+        rerenderAll_ = true;
+    }
+    foreach(QDomNode node, changes.changed) {
+        checkForViewBoxChange(node);
+        queueRerender(node);
+    }
+
     inspectNodes();
-    rerender();
+
+    QList<WbItem*> items;
+    if(rerenderAll_)
+        items = items_;
+    else
+        items = dirtyItems_.toList();
+    dirtyItems_.clear();
+    rerenderAll_ = false;
+
+    rerender(items);
 }
 
 void WbWidget::inspectNodes() {
@@ -355,6 +380,32 @@ void WbWidget::queueNodeInspection(const QDomNode &node) {
         recentlyRelocatedNodes_.append(node);
 }
 
+void WbWidget::queueRerender(const QDomNode &node) {
+    const QDomNode root = session_->document().documentElement();
+
+    // changes to the children of <svg/> affect the drawing order of all items
+    // and changes to <svg/> itself may affect anything
+    if(node == root || node.parentNode() == root) {
+        rerenderAll_ = true;
+        return;
+    }
+
+    // find the child of <svg/> that contains the node
+    QDomNode top = node;
+    while(!top.isNull() && top.parentNode() != root)
+        top = top.parentNode();
+
+    if(top.isNull()) {
+        rerenderAll_ = true;
+        return;
+    }
+
+    // items that don't exist yet are rendered when created
+    WbItem* item = wbItem(top);
+    if(item)
+        dirtyItems_.insert(item);
+}
+
 void WbWidget::removeWbItem(const QDomNode &node) {
     removeWbItem(wbItem(node));
 }
@@ -366,6 +417,7 @@ void WbWidget::removeWbItem(WbItem *wbitem) {
         // items_.takeAt(items_.indexOf(wbitem));
 
         idlessItems_.removeAll(wbitem);
+        dirtyItems_.remove(wbitem);
 
         delete wbitem;
     }
@@ -407,6 +459,10 @@ void WbWidget::checkForRemovalOfId(QDomNode node) {
 }
 
 void WbWidget::rerender() {
+    rerender(items_);
+}
+
+void WbWidget::rerender(const QList<WbItem*> &items) {
     QString xmldump;
     QTextStream stream(&xmldump);
     session_->document().save(stream, 1);
@@ -416,8 +472,8 @@ void WbWidget::rerender() {
 
     renderer_.load(xmldump.toAscii());
 
-    // Update all positions if changed
-    foreach(WbItem* wbitem, items_) {
+    // Update the positions if changed
+    foreach(WbItem* wbitem, items) {
         // resetting elementId is necessary for rendering some updates to the element (e.g. adding child elements to <g/>)
         wbitem->setElementId(wbitem->id());
 
@@ -28,6 +28,7 @@
 #include "wbnewitem.h"
 
 #include <QSvgRenderer>
+#include <QSet>
 #include <QWidget>
 #include <QGraphicsView>
 #include <QTimer>
@@ -111,10 +112,14 @@ private:
     QList<WbItem*> items_;
     // /*! \brief A list of WbItems to be deleted. */
     //     QList<WbItem*> deletionQueue_;
-	/*! \brief A list of QDomNode's that were added since last documentUpdated() signal received. */
+	/*! \brief A list of QDomNode's that were added since last documentChanged() signal received. */
     QList<QDomNode> recentlyRelocatedNodes_;
 	/*! \brief A list of WbItem's whose nodes don't have 'id' attributes. */
     QList<WbItem*> idlessItems_;
+	/*! \brief The WbItem's affected by the changes since the last rerender. */
+    QSet<WbItem*> dirtyItems_;
+	/*! \brief True if all items need to be rerendered at the next documentChanged(). */
+    bool rerenderAll_;
 	/*! \brief Pointer to a new item that is being drawn.*/
     WbNewItem* newWbItem_;
 	/*! \brief Boolean used to force adding a vertex to a path being drawn.*/
@@ -125,13 +130,17 @@ private:
     QSvgRenderer renderer_;
 
 private slots:
-	/*! \brief Tries to add 'id' attributes to nodes in deletionQueue_ if they still don't have them.*/
-    void handleDocumentUpdated(bool remote);
+	/*! \brief Adds, removes and rerenders the items affected by \a changes.*/
+    void handleDocumentChanged(const SxeChangeSet &changes, bool remote);
 	/*! \brief Ensures that an item for the nodes in the inspection queue exist
 	 *      iff they're children of the root <svg/>.*/
 	void inspectNodes();
-	/*! \brief Adds a node to the list of nodes that will be processed by inspectNodes() at next documentUpdated().*/
+	/*! \brief Adds a node to the list of nodes that will be processed by inspectNodes() at next documentChanged().*/
 	void queueNodeInspection(const QDomNode &node);
+	/*! \brief Marks the item containing \a node to be rerendered at next documentChanged().
+	 *  Marks all items if \a node affects the drawing order or isn't contained in an item.
+	 */
+	void queueRerender(const QDomNode &node);
 	/*! \brief Removes the item representing the node (if any).
 	 *  Doesn't affect \a node.
 	 */
@@ -156,6 +165,8 @@ private slots:
 
 	/*! \brief Rerenders the contents of the document.*/
 	void rerender();
+	/*! \brief Reloads the document and updates \a items.*/
+	void rerender(const QList<WbItem*> &items);
 };
 
 #endif
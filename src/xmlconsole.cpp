@@ -29,6 +29,7 @@
 #include "xmpp_client.h"
 #include "xmlconsole.h"
 #include "psiaccount.h"
+#include "xmlringbuffer.h"
 #include "psicon.h"
 #include "psicontactlist.h"
 
@@ -120,16 +121,19 @@ bool XmlConsole::filtered(const QString& str) const
 
 void XmlConsole::dumpRingbuf()
 {
-	QList<PsiAccount::xmlRingElem> buf = pa->dumpRingbuf();
 	bool enablesave = ui_.ck_enable->isChecked();
 	ui_.ck_enable->setChecked(true);
 	QString stamp;
-	foreach (PsiAccount::xmlRingElem el, buf) {
-		stamp = "<!-- TS:" + el.time.toString(Qt::ISODate) + "-->";
-		if (el.type == PsiAccount::RingXmlOut) {
-			client_xmlOutgoing(stamp + el.xml);
+	XmlRingBuffer::ConstIterator it(pa->xmlRingbuf());
+	while (it.next()) {
+		stamp = "<!-- TS:" + it.time().toString(Qt::ISODate) + "-->";
+		if (it.type() == PsiAccount::RingXmlOut) {
+			client_xmlOutgoing(stamp + it.xml());
+		} else if (it.type() == PsiAccount::RingSysMsg) {
+			ui_.te->setColor(Qt::gray);
+			ui_.te->append(stamp + it.xml() + '\n');
 		} else {
-			client_xmlIncoming(stamp + el.xml);
+			client_xmlIncoming(stamp + it.xml());
 		}
 	}
 	ui_.ck_enable->setChecked(enablesave);
@@ -0,0 +1,288 @@
+/*
+ * xmlringbuffer.cpp - byte-bounded history of XML stanzas
+ * Copyright (C) 2008  Psi Development Team
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include "xmlringbuffer.h"
+
+#include <string.h>
+
+// record layout: quint32 length, quint32 time_t, quint8 type, UTF-8 data
+enum {
+	LengthOffset = 0,
+	TimeOffset = 4,
+	TypeOffset = 8,
+	HeaderSize = 9
+};
+
+static inline bool isHighSurrogate(ushort u)
+{
+	return u >= 0xd800 && u < 0xdc00;
+}
+
+static inline bool isLowSurrogate(ushort u)
+{
+	return u >= 0xdc00 && u < 0xe000;
+}
+
+/**
+ * Returns the number of bytes \a str takes when encoded as UTF-8.
+ * Unpaired surrogates count as U+FFFD.
+ */
+static int utf8Length(const QString& str)
+{
+	const QChar* c = str.unicode();
+	const QChar* end = c + str.length();
+	int len = 0;
+	for (; c < end; ++c) {
+		ushort u = c->unicode();
+		if (u < 0x80)
+			len += 1;
+		else if (u < 0x800)
+			len += 2;
+		else if (isHighSurrogate(u) && c + 1 < end && isLowSurrogate((c + 1)->unicode())) {
+			len += 4;
+			++c;
+		}
+		else
+			len += 3;
+	}
+	return len;
+}
+
+/**
+ * Encodes \a str as UTF-8 into \a out, which must have room for
+ * utf8Length(str) bytes.
+ */
+static void encodeUtf8(const QString& str, char* out)
+{
+	uchar* p = reinterpret_cast<uchar*>(out);
+	const QChar* c = str.unicode();
+	const QChar* end = c + str.length();
+	for (; c < end; ++c) {
+		uint u = c->unicode();
+		if (u < 0x80) {
+			*p++ = u;
+			continue;
+		}
+		if (u < 0x800) {
+			*p++ = 0xc0 | (u >> 6);
+			*p++ = 0x80 | (u & 0x3f);
+			continue;
+		}
+		if (isHighSurrogate(u) && c + 1 < end && isLowSurrogate((c + 1)->unicode())) {
+			u = 0x10000 + ((u - 0xd800) << 10) + ((c + 1)->unicode() - 0xdc00);
+			++c;
+			*p++ = 0xf0 | (u >> 18);
+			*p++ = 0x80 | ((u >> 12) & 0x3f);
+			*p++ = 0x80 | ((u >> 6) & 0x3f);
+			*p++ = 0x80 | (u & 0x3f);
+			continue;
+		}
+		if (isHighSurrogate(u) || isLowSurrogate(u))
+			u = 0xfffd;
+		*p++ = 0xe0 | (u >> 12);
+		*p++ = 0x80 | ((u >> 6) & 0x3f);
+		*p++ = 0x80 | (u & 0x3f);
+	}
+}
+
+static inline quint32 readField(const char* record, int offset)
+{
+	quint32 value;
+	memcpy(&value, record + offset, sizeof(value));
+	return value;
+}
+
+/**
+ * Creates a buffer holding at most \a maxBytes of live chunks, allocated
+ * \a chunkSize bytes at a time. If \a compressedBytes is positive, evicted
+ * chunks are kept compressed until they exceed that many bytes.
+ */
+XmlRingBuffer::XmlRingBuffer(int maxBytes, int chunkSize, int compressedBytes)
+	: maxBytes_(maxBytes)
+	, chunkSize_(qMin(chunkSize, maxBytes))
+	, compressedBytes_(compressedBytes)
+	, bytes_(0)
+	, compressedSize_(0)
+{
+}
+
+/**
+ * Stores \a xml with the current time. Stanzas bigger than the whole
+ * buffer are not recorded.
+ */
+void XmlRingBuffer::append(int type, const QString& xml)
+{
+	int len = utf8Length(xml);
+	int needed = HeaderSize + len;
+	if (needed > maxBytes_)
+		return;
+
+	if (chunks_.isEmpty() || chunks_.last().data.size() - chunks_.last().used < needed) {
+		int capacity = qMax(chunkSize_, needed);
+		while (!chunks_.isEmpty() && bytes_ + capacity > maxBytes_)
+			evict();
+		chunks_.append(takeChunk(capacity));
+		bytes_ += capacity;
+	}
+
+	Chunk& chunk = chunks_.last();
+	char* record = chunk.data.data() + chunk.used;
+	quint32 length = len;
+	quint32 time = QDateTime::currentDateTime().toTime_t();
+	quint8 t = type;
+	memcpy(record + LengthOffset, &length, sizeof(length));
+	memcpy(record + TimeOffset, &time, sizeof(time));
+	memcpy(record + TypeOffset, &t, sizeof(t));
+	encodeUtf8(xml, record + HeaderSize);
+	chunk.used += needed;
+}
+
+void XmlRingBuffer::clear()
+{
+	chunks_.clear();
+	compressed_.clear();
+	spare_.clear();
+	bytes_ = 0;
+	compressedSize_ = 0;
+}
+
+/**
+ * Returns the number of bytes allocated for the live chunks.
+ */
+int XmlRingBuffer::size() const
+{
+	return bytes_;
+}
+
+/**
+ * Returns the number of bytes held by compressed chunks.
+ */
+int XmlRingBuffer::compressedSize() const
+{
+	return compressedSize_;
+}
+
+/**
+ * Drops the oldest live chunk, compressing it first if there's a budget
+ * for that. A regular-sized chunk is kept aside to be reused.
+ */
+void XmlRingBuffer::evict()
+{
+	Chunk chunk = chunks_.takeFirst();
+	bytes_ -= chunk.data.size();
+
+	if (compressedBytes_ > 0 && chunk.used > 0) {
+		QByteArray z = qCompress(reinterpret_cast<const uchar*>(chunk.data.constData()), chunk.used);
+		if (z.size() <= compressedBytes_) {
+			compressed_.append(z);
+			compressedSize_ += z.size();
+			while (compressedSize_ > compressedBytes_)
+				compressedSize_ -= compressed_.takeFirst().size();
+		}
+	}
+
+	if (chunk.data.size() == chunkSize_ && spare_.isEmpty())
+		spare_.append(chunk);
+}
+
+XmlRingBuffer::Chunk XmlRingBuffer::takeChunk(int capacity)
+{
+	Chunk chunk;
+	if (capacity == chunkSize_ && !spare_.isEmpty())
+		chunk = spare_.takeFirst();
+	else
+		chunk.data.resize(capacity);
+	chunk.used = 0;
+	return chunk;
+}
+
+//----------------------------------------------------------------------------
+// XmlRingBuffer::ConstIterator
+//----------------------------------------------------------------------------
+
+XmlRingBuffer::ConstIterator::ConstIterator(const XmlRingBuffer& buffer)
+	: buffer_(buffer)
+	, chunk_(-1)
+	, pos_(0)
+	, end_(0)
+	, record_(0)
+{
+}
+
+/**
+ * Advances to the next record. Returns false when there are no more.
+ */
+bool XmlRingBuffer::ConstIterator::next()
+{
+	while (pos_ == end_) {
+		if (!loadChunk())
+			return false;
+	}
+	record_ = pos_;
+	pos_ += HeaderSize + readField(record_, LengthOffset);
+	return true;
+}
+
+bool XmlRingBuffer::ConstIterator::loadChunk()
+{
+	++chunk_;
+	int compressed = buffer_.compressed_.count();
+	if (chunk_ < compressed) {
+		inflated_ = qUncompress(buffer_.compressed_[chunk_]);
+		pos_ = inflated_.constData();
+		end_ = pos_ + inflated_.size();
+		return true;
+	}
+
+	inflated_.clear();
+	if (chunk_ - compressed < buffer_.chunks_.count()) {
+		const Chunk& chunk = buffer_.chunks_[chunk_ - compressed];
+		pos_ = chunk.data.constData();
+		end_ = pos_ + chunk.used;
+		return true;
+	}
+
+	pos_ = end_ = 0;
+	return false;
+}
+
+int XmlRingBuffer::ConstIterator::type() const
+{
+	return quint8(record_[TypeOffset]);
+}
+
+QDateTime XmlRingBuffer::ConstIterator::time() const
+{
+	return QDateTime::fromTime_t(readField(record_, TimeOffset));
+}
+
+/**
+ * Returns the UTF-8 encoded stanza. The returned array refers to the
+ * buffer's memory and is only valid until the iterator moves on.
+ */
+QByteArray XmlRingBuffer::ConstIterator::data() const
+{
+	return QByteArray::fromRawData(record_ + HeaderSize, readField(record_, LengthOffset));
+}
+
+QString XmlRingBuffer::ConstIterator::xml() const
+{
+	return QString::fromUtf8(record_ + HeaderSize, readField(record_, LengthOffset));
+}
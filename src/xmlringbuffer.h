@@ -0,0 +1,93 @@
+/*
+ * xmlringbuffer.h - byte-bounded history of XML stanzas
+ * Copyright (C) 2008  Psi Development Team
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef XMLRINGBUFFER_H
+#define XMLRINGBUFFER_H
+
+#include <QByteArray>
+#include <QList>
+#include <QString>
+#include <QDateTime>
+
+/**
+ * Keeps the most recent XML stanzas of a stream as UTF-8 records in a ring
+ * of preallocated chunks. The oldest chunk is dropped (or compressed, if a
+ * compression budget is set) once the total size limit is reached.
+ */
+class XmlRingBuffer
+{
+public:
+	XmlRingBuffer(int maxBytes = 512 * 1024, int chunkSize = 32 * 1024, int compressedBytes = 0);
+
+	void append(int type, const QString& xml);
+	void clear();
+
+	int size() const;
+	int compressedSize() const;
+
+	/**
+	 * Walks the records from the oldest to the newest. Records in the live
+	 * chunks are returned without copying; compressed chunks are inflated
+	 * one at a time. The buffer must not be modified while iterating.
+	 */
+	class ConstIterator
+	{
+	public:
+		ConstIterator(const XmlRingBuffer& buffer);
+
+		bool next();
+
+		int type() const;
+		QDateTime time() const;
+		QByteArray data() const;
+		QString xml() const;
+
+	private:
+		bool loadChunk();
+
+		const XmlRingBuffer& buffer_;
+		int chunk_;
+		QByteArray inflated_;
+		const char* pos_;
+		const char* end_;
+		const char* record_;
+	};
+
+private:
+	struct Chunk
+	{
+		QByteArray data;
+		int used;
+	};
+
+	void evict();
+	Chunk takeChunk(int capacity);
+
+	int maxBytes_;
+	int chunkSize_;
+	int compressedBytes_;
+	int bytes_;
+	int compressedSize_;
+	QList<Chunk> chunks_;
+	QList<QByteArray> compressed_;
+	QList<Chunk> spare_;
+};
+
+#endif